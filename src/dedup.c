@@ -0,0 +1,306 @@
+// Setting _DEFAULT_SOURCE is necessary to activate visibility of
+// certain header file contents on GNU/Linux systems.
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "dedup.h"
+#include "hash.h"
+
+// Bytes hashed at a time.
+#define DEDUP_BLOCK 65536
+
+// States of the first file of a size.
+#define UNHASHED 0
+#define HASHING 1
+#define HASHED 2
+
+// The top bits pick the shard, the bottom ones the slot in it.
+static uint64_t key_hash(uint64_t a, uint64_t b) {
+  return fmix64(a * 0x9e3779b97f4a7c15ULL ^ fmix64(b));
+}
+
+static void set_init(struct dedup_set *s) {
+  for (int i = 0; i < DEDUP_SHARDS; i++) {
+    struct dedup_shard *sh = &s->shards[i];
+    pthread_mutex_init(&sh->lock, NULL);
+    pthread_cond_init(&sh->cond, NULL);
+    sh->entries = NULL;
+    sh->cap = 0;
+    sh->num = 0;
+  }
+}
+
+static void set_free(struct dedup_set *s) {
+  for (int i = 0; i < DEDUP_SHARDS; i++) {
+    struct dedup_shard *sh = &s->shards[i];
+    for (size_t j = 0; j < sh->cap; j++)
+      free(sh->entries[j].path);
+    free(sh->entries);
+    pthread_mutex_destroy(&sh->lock);
+    pthread_cond_destroy(&sh->cond);
+  }
+}
+
+void dedup_init(struct dedup *d) {
+  set_init(&d->inodes);
+  set_init(&d->sizes);
+  set_init(&d->contents);
+}
+
+void dedup_free(struct dedup *d) {
+  set_free(&d->inodes);
+  set_free(&d->sizes);
+  set_free(&d->contents);
+}
+
+// The slot of (a, b) in 'sh': where it is, or where it would go.
+static struct dedup_entry *slot(struct dedup_shard *sh, uint64_t a,
+                                uint64_t b) {
+  size_t i = key_hash(a, b) & (sh->cap - 1);
+  while (sh->entries[i].used &&
+         (sh->entries[i].a != a || sh->entries[i].b != b))
+    i = (i + 1) & (sh->cap - 1);
+  return &sh->entries[i];
+}
+
+// Make room for one more entry, keeping 'sh' at most half full.
+static int reserve(struct dedup_shard *sh) {
+  if (2 * (sh->num + 1) <= sh->cap)
+    return 0;
+
+  size_t old_cap = sh->cap;
+  struct dedup_entry *old = sh->entries;
+  size_t cap = old_cap ? 2 * old_cap : 64;
+  struct dedup_entry *entries = calloc(cap, sizeof(struct dedup_entry));
+  if (entries == NULL)
+    return -1;
+
+  sh->entries = entries;
+  sh->cap = cap;
+  for (size_t i = 0; i < old_cap; i++) {
+    if (old[i].used)
+      *slot(sh, old[i].a, old[i].b) = old[i];
+  }
+  free(old);
+  return 0;
+}
+
+// Find (a, b) in 's', adding it if it is not there, and set '*found'
+// if it was.  Returns the entry with the lock of its shard ('*shard')
+// held, or NULL and no lock if out of memory.  The entry may move once
+// the lock is let go.
+static struct dedup_entry *lookup(struct dedup_set *s, uint64_t a,
+                                  uint64_t b, struct dedup_shard **shard,
+                                  int *found) {
+  struct dedup_shard *sh = &s->shards[key_hash(a, b) >> 58];
+
+  pthread_mutex_lock(&sh->lock);
+  if (reserve(sh) != 0) {
+    pthread_mutex_unlock(&sh->lock);
+    return NULL;
+  }
+
+  struct dedup_entry *e = slot(sh, a, b);
+  *found = e->used;
+  if (!e->used) {
+    e->used = 1;
+    e->a = a;
+    e->b = b;
+    sh->num++;
+  }
+  *shard = sh;
+  return e;
+}
+
+// Add (a, b) to 's'.  Returns whether it was there already.
+static int record(struct dedup_set *s, uint64_t a, uint64_t b) {
+  struct dedup_shard *sh;
+  int found;
+  if (lookup(s, a, b, &sh, &found) == NULL)
+    return 0;
+  pthread_mutex_unlock(&sh->lock);
+  return found;
+}
+
+// Add (a, b) to 's' on behalf of the file at 'path'.  Returns NULL if
+// it is new, or else a copy (to be freed) of the path of the file it
+// was first added for.
+static char *record_path(struct dedup_set *s, uint64_t a, uint64_t b,
+                         const char *path) {
+  struct dedup_shard *sh;
+  int found;
+  struct dedup_entry *e = lookup(s, a, b, &sh, &found);
+  if (e == NULL)
+    return NULL;
+
+  char *first = NULL;
+  if (!found)
+    e->path = strdup(path);
+  else if (e->path != NULL)
+    first = strdup(e->path);
+  pthread_mutex_unlock(&sh->lock);
+  return first;
+}
+
+int dedup_inode(struct dedup *d, dev_t dev, ino_t ino) {
+  return record(&d->inodes, (uint64_t)dev, (uint64_t)ino);
+}
+
+const char *dedup_size(struct dedup *d, const char *path, off_t size) {
+  struct dedup_shard *sh;
+  int found;
+  struct dedup_entry *e = lookup(&d->sizes, (uint64_t)size, 0, &sh, &found);
+  if (e == NULL)
+    return NULL;
+
+  const char *peer = NULL;
+  if (found)
+    peer = e->path;
+  else
+    e->path = strdup(path);
+  pthread_mutex_unlock(&sh->lock);
+  return peer;
+}
+
+// Hash the contents of 'path', as stats.c does, and count them.
+static int hash_file(const char *path, uint64_t *hash, uint64_t *len) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return -1;
+  unsigned char *buf = malloc(DEDUP_BLOCK);
+  if (buf == NULL) {
+    close(fd);
+    return -1;
+  }
+
+  uint64_t h = 0;
+  uint64_t total = 0;
+  size_t have = 0;
+  int rc = 0;
+  for (;;) {
+    ssize_t n = read(fd, buf + have, DEDUP_BLOCK - have);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0) {
+      rc = -1;
+      break;
+    }
+    have += (size_t)n;
+    if (n > 0 && have < DEDUP_BLOCK)
+      continue;
+
+    // A full block, or the last one.
+    size_t i = 0;
+    for (; i + 8 <= have; i += 8)
+      h = hash_word(h, load64(buf + i));
+    total += have;
+    if (n == 0) {
+      if (i < have) {
+        memset(buf + have, 0, 8 - (have - i));
+        h = hash_word(h, load64(buf + i));
+      }
+      break;
+    }
+    have = 0;
+  }
+
+  free(buf);
+  close(fd);
+  *hash = hash_end(h, total);
+  *len = total;
+  return rc;
+}
+
+// Read all of 'fd' that fits in 'buf', short only at the end.
+static ssize_t read_block(int fd, unsigned char *buf, size_t len) {
+  size_t have = 0;
+  while (have < len) {
+    ssize_t n = read(fd, buf + have, len - have);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      return -1;
+    if (n == 0)
+      break;
+    have += (size_t)n;
+  }
+  return (ssize_t)have;
+}
+
+// Whether the files at 'a' and 'b' hold the same bytes.
+static int same_contents(const char *a, const char *b) {
+  int fa = open(a, O_RDONLY);
+  int fb = open(b, O_RDONLY);
+  unsigned char *ba = malloc(DEDUP_BLOCK);
+  unsigned char *bb = malloc(DEDUP_BLOCK);
+  int same = fa >= 0 && fb >= 0 && ba != NULL && bb != NULL;
+
+  while (same) {
+    ssize_t na = read_block(fa, ba, DEDUP_BLOCK);
+    ssize_t nb = read_block(fb, bb, DEDUP_BLOCK);
+    if (na < 0 || na != nb || memcmp(ba, bb, (size_t)na) != 0)
+      same = 0;
+    else if (na == 0)
+      break;
+  }
+
+  free(ba);
+  free(bb);
+  if (fa >= 0)
+    close(fa);
+  if (fb >= 0)
+    close(fb);
+  return same;
+}
+
+int dedup_content(struct dedup *d, const char *path, off_t size,
+                  const char *peer) {
+  uint64_t h, len;
+
+  // The first file of this size is only hashed now that there is
+  // something to compare it with.  Other threads checking a file of
+  // the same size wait until it is done.
+  struct dedup_shard *sh;
+  int found;
+  struct dedup_entry *e = lookup(&d->sizes, (uint64_t)size, 0, &sh, &found);
+  if (e == NULL)
+    return 0;
+  while (e->state == HASHING) {
+    pthread_cond_wait(&sh->cond, &sh->lock);
+    e = slot(sh, (uint64_t)size, 0);
+  }
+  if (e->state == UNHASHED) {
+    e->state = HASHING;
+    pthread_mutex_unlock(&sh->lock);
+
+    if (hash_file(peer, &h, &len) == 0)
+      free(record_path(&d->contents, len, h, peer));
+
+    pthread_mutex_lock(&sh->lock);
+    e = slot(sh, (uint64_t)size, 0);
+    e->state = HASHED;
+    pthread_cond_broadcast(&sh->cond);
+  }
+  pthread_mutex_unlock(&sh->lock);
+
+  if (hash_file(path, &h, &len) != 0)
+    return 0;
+
+  // The hash is not cryptographic, so files that collide are easily
+  // made; only the bytes themselves can tell.
+  char *first = record_path(&d->contents, len, h, path);
+  if (first == NULL)
+    return 0;
+  int same = same_contents(path, first);
+  free(first);
+  return same;
+}
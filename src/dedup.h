@@ -0,0 +1,65 @@
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Sets of what a run has seen already, so that each file is scanned
+// once however many paths lead to it: by (device, inode), for hard
+// links and for the symbolic links that FTS_LOGICAL follows, and, with
+// --dedup-content, by size and content hash, for copies.
+//
+// The sets are split into shards, each under its own lock, so that
+// the traversal and the workers rarely wait for each other.
+
+#define DEDUP_SHARDS 64
+
+struct dedup_entry {
+  uint64_t a, b; // The key.
+  int used;
+  int state;     // Sizes: whether the first file has been hashed.
+  char *path;    // Sizes and contents: the first file with the key.
+};
+
+struct dedup_shard {
+  pthread_mutex_t lock;
+  pthread_cond_t cond; // Sizes: broadcast when a first file is hashed.
+  struct dedup_entry *entries; // Open addressing, NULL until needed.
+  size_t cap;
+  size_t num;
+};
+
+struct dedup_set {
+  struct dedup_shard shards[DEDUP_SHARDS];
+};
+
+struct dedup {
+  struct dedup_set inodes;   // (device, inode)
+  struct dedup_set sizes;    // (size, 0) -> the first file of that size
+  struct dedup_set contents; // (size, content hash) -> the first file
+};
+
+void dedup_init(struct dedup *d);
+void dedup_free(struct dedup *d);
+
+// Record the file or directory (dev, ino).  Returns 1 if it was seen
+// before, 0 if not (or if there is no memory to remember it).
+int dedup_inode(struct dedup *d, dev_t dev, ino_t ino);
+
+// Record that the file at 'path', of 'size' bytes, is to be scanned.
+// Returns NULL if it is the first of that size, and cannot be a copy
+// of anything yet, or else the path of that first file, to be passed
+// to dedup_content().  The path stays valid until dedup_free().
+const char *dedup_size(struct dedup *d, const char *path, off_t size);
+
+// Whether the file at 'path', of 'size' bytes, has the same contents
+// as one that was checked before, or as 'peer' (from dedup_size()).
+// Reads the file, and 'peer' the first time it is needed.  The hash
+// only picks the file to compare with; a file is a copy only if its
+// bytes are the same.  Files that cannot be read are taken to be
+// different.
+int dedup_content(struct dedup *d, const char *path, off_t size,
+                  const char *peer);
+
+#endif
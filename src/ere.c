@@ -0,0 +1,1051 @@
+// Setting _GNU_SOURCE is necessary for memmem() and for choosing the
+// rwlock preference below.
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+
+#include "ere.h"
+#include "search.h"
+
+// Upper bound on the size of the NFA program, mostly to keep '{m,n}'
+// from blowing up.
+#define ERE_MAX_PROG 100000
+#define ERE_MAX_REPEAT 1000
+#define ERE_MAX_DEPTH 1000
+
+// How many times a single line is retried on the DFA after another
+// thread flushed the cache, before we give up and simulate the NFA.
+#define ERE_MAX_RESTARTS 3
+
+enum { OP_BYTE, OP_SPLIT, OP_JMP, OP_BOL, OP_EOL, OP_MATCH };
+
+struct ere_inst {
+  int op;
+  int x, y;        // Branch targets for OP_SPLIT and OP_JMP.
+  uint32_t set[8]; // Accepted bytes for OP_BYTE.
+};
+
+// A DFA state is a canonical (sorted) set of NFA program counters.
+// Only instructions that matter after the epsilon closure are kept:
+// OP_BYTE, OP_MATCH, and OP_EOL (which may still be passed if the
+// line ends here).
+struct ere_state {
+  int next[256];   // Successor for each byte, or -1 if not built yet.
+  int matched;     // Contains OP_MATCH.
+  int eol_matched; // Would match if the line ended here.
+  int dead;        // No NFA states left; nothing can match any more.
+  unsigned hash;
+  int len;
+  int pcs[];
+};
+
+// Sparse set of program counters, with O(1) clear.
+struct ere_pcset {
+  int *dense;
+  int *sparse;
+  int n;
+};
+
+//
+// Byte sets.
+//
+
+static void set_add(uint32_t set[8], int c) { set[c >> 5] |= 1u << (c & 31); }
+
+static int set_has(const uint32_t set[8], int c) {
+  return (set[c >> 5] >> (c & 31)) & 1;
+}
+
+static void set_fold(uint32_t set[8]) {
+  for (int c = 'a'; c <= 'z'; c++) {
+    if (set_has(set, c) || set_has(set, toupper(c))) {
+      set_add(set, c);
+      set_add(set, toupper(c));
+    }
+  }
+}
+
+static void set_invert(uint32_t set[8]) {
+  for (int i = 0; i < 8; i++) {
+    set[i] = ~set[i];
+  }
+}
+
+static int set_named(uint32_t set[8], const char *name, size_t len) {
+  static const struct {
+    const char *name;
+    int (*pred)(int);
+  } classes[] = {
+      {"alpha", isalpha}, {"digit", isdigit}, {"alnum", isalnum},
+      {"upper", isupper}, {"lower", islower}, {"space", isspace},
+      {"blank", isblank}, {"punct", ispunct}, {"print", isprint},
+      {"graph", isgraph}, {"cntrl", iscntrl}, {"xdigit", isxdigit},
+  };
+
+  for (size_t i = 0; i < sizeof(classes) / sizeof(classes[0]); i++) {
+    if (strlen(classes[i].name) == len &&
+        strncmp(classes[i].name, name, len) == 0) {
+      // Only ASCII, so the result does not depend on the locale.
+      for (int c = 0; c < 128; c++) {
+        if (classes[i].pred(c)) {
+          set_add(set, c);
+        }
+      }
+      return 0;
+    }
+  }
+  return -1;
+}
+
+//
+// Parsing into a syntax tree.
+//
+
+enum {
+  N_EMPTY,
+  N_SET,
+  N_CAT,
+  N_ALT,
+  N_STAR,
+  N_PLUS,
+  N_QUEST,
+  N_REPEAT,
+  N_BOL,
+  N_EOL
+};
+
+struct node {
+  int type;
+  struct node *l, *r;
+  int min, max;    // For N_REPEAT; 'max' is -1 if unbounded.
+  int lit;         // For N_SET: the byte, if this is a plain literal.
+  uint32_t set[8]; // For N_SET.
+  struct node *allocated; // All nodes, for freeing.
+};
+
+struct parser {
+  const char *p;
+  int flags;
+  int depth;
+  const char *error;
+  struct node *nodes;
+};
+
+static struct node *parse_alt(struct parser *ps);
+
+static struct node *new_node(struct parser *ps, int type, struct node *l,
+                             struct node *r) {
+  struct node *n = calloc(1, sizeof(struct node));
+  if (n == NULL) {
+    ps->error = "out of memory";
+    return NULL;
+  }
+  n->type = type;
+  n->l = l;
+  n->r = r;
+  n->lit = -1;
+  n->allocated = ps->nodes;
+  ps->nodes = n;
+  return n;
+}
+
+static struct node *new_set(struct parser *ps, const uint32_t set[8],
+                            int lit) {
+  struct node *n = new_node(ps, N_SET, NULL, NULL);
+  if (n == NULL) {
+    return NULL;
+  }
+  memcpy(n->set, set, sizeof(n->set));
+  if (ps->flags & ERE_ICASE) {
+    set_fold(n->set);
+  }
+  n->lit = lit;
+  return n;
+}
+
+static struct node *new_literal(struct parser *ps, int c) {
+  uint32_t set[8] = {0};
+  set_add(set, c);
+  return new_set(ps, set, c);
+}
+
+static struct node *parse_class(struct parser *ps) {
+  uint32_t set[8] = {0};
+  int negate = 0;
+
+  if (*ps->p == '^') {
+    negate = 1;
+    ps->p++;
+  }
+
+  // A ']' right after the opening bracket is taken literally.
+  int first = 1;
+  while (first || *ps->p != ']') {
+    first = 0;
+    if (*ps->p == '\0') {
+      ps->error = "missing ]";
+      return NULL;
+    }
+
+    if (ps->p[0] == '[' && ps->p[1] == ':') {
+      const char *name = ps->p + 2;
+      const char *end = strstr(name, ":]");
+      if (end == NULL || set_named(set, name, (size_t)(end - name)) != 0) {
+        ps->error = "invalid character class";
+        return NULL;
+      }
+      ps->p = end + 2;
+      continue;
+    }
+
+    int lo = (unsigned char)*ps->p++;
+    if (ps->p[0] == '-' && ps->p[1] != ']' && ps->p[1] != '\0') {
+      int hi = (unsigned char)ps->p[1];
+      ps->p += 2;
+      if (hi < lo) {
+        ps->error = "invalid range";
+        return NULL;
+      }
+      for (int c = lo; c <= hi; c++) {
+        set_add(set, c);
+      }
+    } else {
+      set_add(set, lo);
+    }
+  }
+  ps->p++;
+
+  if (ps->flags & ERE_ICASE) {
+    set_fold(set);
+  }
+  if (negate) {
+    set_invert(set);
+  }
+  return new_set(ps, set, -1);
+}
+
+static struct node *parse_escape(struct parser *ps) {
+  uint32_t set[8] = {0};
+  int c = (unsigned char)*ps->p++;
+
+  switch (c) {
+  case '\0':
+    ps->error = "trailing backslash";
+    return NULL;
+  case 'd':
+  case 'D':
+    set_named(set, "digit", 5);
+    break;
+  case 'w':
+  case 'W':
+    set_named(set, "alnum", 5);
+    set_add(set, '_');
+    break;
+  case 's':
+  case 'S':
+    set_named(set, "space", 5);
+    break;
+  case 't':
+    return new_literal(ps, '\t');
+  case 'n':
+    return new_literal(ps, '\n');
+  default:
+    return new_literal(ps, c);
+  }
+
+  if (isupper(c)) {
+    set_invert(set);
+  }
+  return new_set(ps, set, -1);
+}
+
+static struct node *parse_atom(struct parser *ps) {
+  int c = (unsigned char)*ps->p++;
+
+  switch (c) {
+  case '(': {
+    if (++ps->depth > ERE_MAX_DEPTH) {
+      ps->error = "parentheses nested too deeply";
+      return NULL;
+    }
+    struct node *n = parse_alt(ps);
+    if (n == NULL) {
+      return NULL;
+    }
+    if (*ps->p != ')') {
+      ps->error = "missing )";
+      return NULL;
+    }
+    ps->p++;
+    ps->depth--;
+    return n;
+  }
+  case '[':
+    return parse_class(ps);
+  case '.': {
+    uint32_t set[8] = {0};
+    set_invert(set);
+    set[0] &= ~(1u << '\n');
+    return new_set(ps, set, -1);
+  }
+  case '^':
+    return new_node(ps, N_BOL, NULL, NULL);
+  case '$':
+    return new_node(ps, N_EOL, NULL, NULL);
+  case '\\':
+    return parse_escape(ps);
+  case '*':
+  case '+':
+  case '?':
+    ps->error = "nothing to repeat";
+    return NULL;
+  default:
+    return new_literal(ps, c);
+  }
+}
+
+// Parse a decimal number of at most ERE_MAX_REPEAT.  Returns -1 if
+// there are no digits.
+static int parse_count(struct parser *ps) {
+  if (!isdigit((unsigned char)*ps->p)) {
+    return -1;
+  }
+  int n = 0;
+  while (isdigit((unsigned char)*ps->p)) {
+    n = n * 10 + (*ps->p++ - '0');
+    if (n > ERE_MAX_REPEAT) {
+      n = ERE_MAX_REPEAT + 1;
+    }
+  }
+  return n;
+}
+
+static struct node *parse_repeat(struct parser *ps) {
+  struct node *n = parse_atom(ps);
+
+  while (n != NULL) {
+    switch (*ps->p) {
+    case '*':
+      n = new_node(ps, N_STAR, n, NULL);
+      break;
+    case '+':
+      n = new_node(ps, N_PLUS, n, NULL);
+      break;
+    case '?':
+      n = new_node(ps, N_QUEST, n, NULL);
+      break;
+    case '{': {
+      // A '{' that does not start a valid bound is just a literal,
+      // like in GNU grep.
+      const char *save = ps->p++;
+      int min = parse_count(ps);
+      int max = min;
+      if (min >= 0 && *ps->p == ',') {
+        ps->p++;
+        max = *ps->p == '}' ? -1 : parse_count(ps);
+      }
+      if (min < 0 || *ps->p != '}' || (max >= 0 && max < min)) {
+        ps->p = save;
+        return n;
+      }
+      if (min > ERE_MAX_REPEAT || max > ERE_MAX_REPEAT) {
+        ps->error = "repetition count too large";
+        return NULL;
+      }
+      n = new_node(ps, N_REPEAT, n, NULL);
+      if (n != NULL) {
+        n->min = min;
+        n->max = max;
+      }
+      break;
+    }
+    default:
+      return n;
+    }
+    ps->p++;
+  }
+  return NULL;
+}
+
+static struct node *parse_cat(struct parser *ps) {
+  struct node *n = new_node(ps, N_EMPTY, NULL, NULL);
+
+  while (n != NULL && *ps->p != '\0' && *ps->p != '|' && *ps->p != ')') {
+    struct node *r = parse_repeat(ps);
+    if (r == NULL) {
+      return NULL;
+    }
+    n = n->type == N_EMPTY ? r : new_node(ps, N_CAT, n, r);
+  }
+  return n;
+}
+
+static struct node *parse_alt(struct parser *ps) {
+  struct node *n = parse_cat(ps);
+
+  while (n != NULL && *ps->p == '|') {
+    ps->p++;
+    struct node *r = parse_cat(ps);
+    if (r == NULL) {
+      return NULL;
+    }
+    n = new_node(ps, N_ALT, n, r);
+  }
+  return n;
+}
+
+static void free_nodes(struct parser *ps) {
+  while (ps->nodes != NULL) {
+    struct node *next = ps->nodes->allocated;
+    free(ps->nodes);
+    ps->nodes = next;
+  }
+}
+
+//
+// Compiling the syntax tree to an NFA program.
+//
+
+struct program {
+  struct ere_inst *insts;
+  int len;
+  int capacity;
+  int overflow;
+};
+
+// Append an instruction and return its index.  On overflow, the
+// last instruction is reused and 'overflow' is set, so callers do
+// not need to check every emit.
+static int emit(struct program *pg, int op) {
+  if (pg->len == pg->capacity) {
+    int capacity = pg->capacity ? pg->capacity * 2 : 64;
+    struct ere_inst *insts = NULL;
+    if (capacity <= ERE_MAX_PROG) {
+      insts = realloc(pg->insts, (size_t)capacity * sizeof(struct ere_inst));
+    }
+    if (insts == NULL) {
+      pg->overflow = 1;
+      return pg->len - 1;
+    }
+    pg->insts = insts;
+    pg->capacity = capacity;
+  }
+  memset(&pg->insts[pg->len], 0, sizeof(struct ere_inst));
+  pg->insts[pg->len].op = op;
+  return pg->len++;
+}
+
+static void compile_node(struct program *pg, const struct node *n) {
+  int s, j, start;
+
+  if (pg->overflow) {
+    return;
+  }
+
+  switch (n->type) {
+  case N_EMPTY:
+    break;
+  case N_SET:
+    s = emit(pg, OP_BYTE);
+    memcpy(pg->insts[s].set, n->set, sizeof(n->set));
+    break;
+  case N_CAT:
+    compile_node(pg, n->l);
+    compile_node(pg, n->r);
+    break;
+  case N_ALT:
+    s = emit(pg, OP_SPLIT);
+    pg->insts[s].x = s + 1;
+    compile_node(pg, n->l);
+    j = emit(pg, OP_JMP);
+    pg->insts[s].y = pg->len;
+    compile_node(pg, n->r);
+    pg->insts[j].x = pg->len;
+    break;
+  case N_STAR:
+    s = emit(pg, OP_SPLIT);
+    pg->insts[s].x = s + 1;
+    compile_node(pg, n->l);
+    j = emit(pg, OP_JMP);
+    pg->insts[j].x = s;
+    pg->insts[s].y = pg->len;
+    break;
+  case N_PLUS:
+    start = pg->len;
+    compile_node(pg, n->l);
+    s = emit(pg, OP_SPLIT);
+    pg->insts[s].x = start;
+    pg->insts[s].y = s + 1;
+    break;
+  case N_QUEST:
+    s = emit(pg, OP_SPLIT);
+    pg->insts[s].x = s + 1;
+    compile_node(pg, n->l);
+    pg->insts[s].y = pg->len;
+    break;
+  case N_REPEAT:
+    for (int i = 0; i < n->min; i++) {
+      compile_node(pg, n->l);
+    }
+    if (n->max < 0) {
+      struct node star = {.type = N_STAR, .l = n->l};
+      compile_node(pg, &star);
+    } else {
+      struct node quest = {.type = N_QUEST, .l = n->l};
+      for (int i = n->min; i < n->max; i++) {
+        compile_node(pg, &quest);
+      }
+    }
+    break;
+  case N_BOL:
+    emit(pg, OP_BOL);
+    break;
+  case N_EOL:
+    emit(pg, OP_EOL);
+    break;
+  }
+}
+
+//
+// Required literal extraction.
+//
+
+struct litscan {
+  char *run;
+  size_t run_len;
+  char *best;
+  size_t best_len;
+};
+
+static void lit_commit(struct litscan *ls) {
+  if (ls->run_len > ls->best_len) {
+    memcpy(ls->best, ls->run, ls->run_len);
+    ls->best_len = ls->run_len;
+  }
+  ls->run_len = 0;
+}
+
+// Walk the nodes that every match must pass through, in order,
+// collecting runs of adjacent literal bytes.
+static void lit_walk(const struct node *n, struct litscan *ls) {
+  switch (n->type) {
+  case N_EMPTY:
+    break;
+  case N_CAT:
+    lit_walk(n->l, ls);
+    lit_walk(n->r, ls);
+    break;
+  case N_SET:
+    if (n->lit >= 0) {
+      ls->run[ls->run_len++] = (char)n->lit;
+    } else {
+      lit_commit(ls);
+    }
+    break;
+  case N_PLUS:
+  case N_REPEAT:
+    lit_commit(ls);
+    if (n->type == N_PLUS || n->min > 0) {
+      lit_walk(n->l, ls);
+      lit_commit(ls);
+    }
+    break;
+  default:
+    lit_commit(ls);
+    break;
+  }
+}
+
+static int is_literal(const struct node *n) {
+  switch (n->type) {
+  case N_SET:
+    return n->lit >= 0;
+  case N_CAT:
+    return is_literal(n->l) && is_literal(n->r);
+  default:
+    return 0;
+  }
+}
+
+static int find_literal(struct ere *re, const struct node *root,
+                        size_t max_len) {
+  struct litscan ls = {0};
+  ls.run = malloc(max_len + 1);
+  ls.best = malloc(max_len + 1);
+  if (ls.run == NULL || ls.best == NULL) {
+    free(ls.run);
+    free(ls.best);
+    return -1;
+  }
+
+  lit_walk(root, &ls);
+  lit_commit(&ls);
+  free(ls.run);
+
+  if (ls.best_len == 0) {
+    free(ls.best);
+    return 0;
+  }
+
+  ls.best[ls.best_len] = '\0';
+  if (re->flags & ERE_ICASE) {
+    // Searched for with search_ci(), which wants it folded.
+    search_fold(ls.best, ls.best_len);
+  }
+  re->literal = ls.best;
+  re->literal_len = ls.best_len;
+  re->literal_only = is_literal(root);
+  return 0;
+}
+
+//
+// NFA simulation primitives, shared by the DFA builder and the
+// fallback matcher.
+//
+
+static struct ere_pcset *pcset_new(int size) {
+  struct ere_pcset *s = malloc(sizeof(struct ere_pcset));
+  if (s == NULL) {
+    return NULL;
+  }
+  s->dense = malloc((size_t)size * sizeof(int));
+  // Zeroed so that lookups never read uninitialised memory.
+  s->sparse = calloc((size_t)size, sizeof(int));
+  s->n = 0;
+  if (s->dense == NULL || s->sparse == NULL) {
+    free(s->dense);
+    free(s->sparse);
+    free(s);
+    return NULL;
+  }
+  return s;
+}
+
+static void pcset_free(struct ere_pcset *s) {
+  if (s != NULL) {
+    free(s->dense);
+    free(s->sparse);
+    free(s);
+  }
+}
+
+static int pcset_has(const struct ere_pcset *s, int pc) {
+  int i = s->sparse[pc];
+  return i < s->n && s->dense[i] == pc;
+}
+
+static void pcset_add(struct ere_pcset *s, int pc) {
+  s->sparse[pc] = s->n;
+  s->dense[s->n++] = pc;
+}
+
+// Add 'pc' and everything reachable from it without consuming input
+// to 'set'.  'stack' must have room for 2 * prog_len + 1 entries.
+static void closure(const struct ere *re, struct ere_pcset *set, int *stack,
+                    int pc, int at_bol, int at_eol) {
+  int sp = 0;
+  stack[sp++] = pc;
+
+  while (sp > 0) {
+    pc = stack[--sp];
+    if (pcset_has(set, pc)) {
+      continue;
+    }
+    pcset_add(set, pc);
+
+    const struct ere_inst *in = &re->prog[pc];
+    switch (in->op) {
+    case OP_SPLIT:
+      stack[sp++] = in->y;
+      stack[sp++] = in->x;
+      break;
+    case OP_JMP:
+      stack[sp++] = in->x;
+      break;
+    case OP_BOL:
+      if (at_bol) {
+        stack[sp++] = pc + 1;
+      }
+      break;
+    case OP_EOL:
+      if (at_eol) {
+        stack[sp++] = pc + 1;
+      }
+      break;
+    default:
+      break;
+    }
+  }
+}
+
+// Compute the NFA states reached from 'pcs' by consuming byte 'c'.
+// Since we search for a match anywhere in the line, a new attempt is
+// started at every position.
+static void step(const struct ere *re, const int *pcs, int n, int c,
+                 struct ere_pcset *out, int *stack) {
+  out->n = 0;
+  for (int i = 0; i < n; i++) {
+    const struct ere_inst *in = &re->prog[pcs[i]];
+    if (in->op == OP_BYTE && set_has(in->set, c)) {
+      closure(re, out, stack, pcs[i] + 1, 0, 0);
+    }
+  }
+  closure(re, out, stack, 0, 0, 0);
+}
+
+static int kept(const struct ere *re, int pc) {
+  int op = re->prog[pc].op;
+  return op == OP_BYTE || op == OP_EOL || op == OP_MATCH;
+}
+
+// Copy the instructions of 'set' that are part of a DFA state into
+// 'pcs', and return how many there were.
+static int collect(const struct ere *re, const struct ere_pcset *set,
+                   int *pcs) {
+  int n = 0;
+  for (int i = 0; i < set->n; i++) {
+    if (kept(re, set->dense[i])) {
+      pcs[n++] = set->dense[i];
+    }
+  }
+  return n;
+}
+
+static int has_match(const struct ere *re, const int *pcs, int n) {
+  for (int i = 0; i < n; i++) {
+    if (re->prog[pcs[i]].op == OP_MATCH) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Would 'pcs' match if the line ended right here?
+static int matches_at_eol(const struct ere *re, const int *pcs, int n,
+                          struct ere_pcset *tmp, int *stack) {
+  tmp->n = 0;
+  for (int i = 0; i < n; i++) {
+    if (re->prog[pcs[i]].op == OP_EOL) {
+      closure(re, tmp, stack, pcs[i], 0, 1);
+    }
+  }
+  for (int i = 0; i < tmp->n; i++) {
+    if (re->prog[tmp->dense[i]].op == OP_MATCH) {
+      return 1;
+    }
+  }
+  return has_match(re, pcs, n);
+}
+
+// Simulate the NFA directly, without touching the DFA cache.  Only
+// used when other threads keep flushing the cache under our feet.
+static int nfa_match(const struct ere *re, const unsigned char *text,
+                     size_t len) {
+  struct ere_pcset *cur = pcset_new(re->prog_len);
+  struct ere_pcset *tmp = pcset_new(re->prog_len);
+  int *stack = malloc((2 * (size_t)re->prog_len + 1) * sizeof(int));
+  int *pcs = malloc((size_t)re->prog_len * sizeof(int));
+  int result = 0;
+
+  if (cur == NULL || tmp == NULL || stack == NULL || pcs == NULL) {
+    // Can't say no without looking; err on the side of printing.
+    result = 1;
+    goto out;
+  }
+
+  closure(re, cur, stack, 0, 1, 0);
+  int n = collect(re, cur, pcs);
+  for (size_t i = 0; i < len && !has_match(re, pcs, n); i++) {
+    step(re, pcs, n, text[i], cur, stack);
+    n = collect(re, cur, pcs);
+  }
+  result = matches_at_eol(re, pcs, n, tmp, stack);
+
+out:
+  pcset_free(cur);
+  pcset_free(tmp);
+  free(stack);
+  free(pcs);
+  return result;
+}
+
+//
+// The lazy DFA.
+//
+
+static int cmp_int(const void *a, const void *b) {
+  int x = *(const int *)a, y = *(const int *)b;
+  return (x > y) - (x < y);
+}
+
+static unsigned hash_pcs(const int *pcs, int n) {
+  unsigned h = 2166136261u;
+  for (int i = 0; i < n; i++) {
+    h = (h ^ (unsigned)pcs[i]) * 16777619u;
+  }
+  return h;
+}
+
+// Throw away every DFA state.  Must hold the write lock.
+static void flush(struct ere *re) {
+  for (int i = 0; i < re->num_states; i++) {
+    free(re->states[i]);
+  }
+  for (int i = 0; i < re->table_size; i++) {
+    re->table[i] = -1;
+  }
+  re->num_states = 0;
+  re->cache_bytes = 0;
+  re->start = -1;
+  re->generation++;
+}
+
+// Find or create the DFA state for the NFA states in 'set'.  Must
+// hold the write lock.  Sets '*flushed' if the cache had to be
+// flushed to make room, in which case all other state numbers are
+// invalid.  Returns -1 if out of memory.
+static int intern(struct ere *re, struct ere_pcset *set, int *flushed) {
+  int *pcs = re->stack;
+  int n = collect(re, set, pcs);
+  qsort(pcs, (size_t)n, sizeof(int), cmp_int);
+
+  unsigned hash = hash_pcs(pcs, n);
+  int mask = re->table_size - 1;
+  int slot = (int)(hash & (unsigned)mask);
+
+  for (; re->table[slot] >= 0; slot = (slot + 1) & mask) {
+    struct ere_state *st = re->states[re->table[slot]];
+    if (st->hash == hash && st->len == n &&
+        memcmp(st->pcs, pcs, (size_t)n * sizeof(int)) == 0) {
+      return re->table[slot];
+    }
+  }
+
+  size_t bytes = sizeof(struct ere_state) + (size_t)n * sizeof(int);
+  if (re->num_states > 0 && (re->cache_bytes + bytes > re->cache_limit ||
+                             re->num_states == re->states_capacity)) {
+    flush(re);
+    *flushed = 1;
+    slot = (int)(hash & (unsigned)mask);
+  }
+
+  struct ere_state *st = malloc(bytes);
+  if (st == NULL) {
+    return -1;
+  }
+  for (int c = 0; c < 256; c++) {
+    st->next[c] = -1;
+  }
+  st->hash = hash;
+  st->len = n;
+  memcpy(st->pcs, pcs, (size_t)n * sizeof(int));
+  st->matched = has_match(re, st->pcs, n);
+  st->eol_matched = matches_at_eol(re, st->pcs, n, re->scratch_eol, re->stack);
+  st->dead = n == 0;
+
+  int id = re->num_states++;
+  re->states[id] = st;
+  re->table[slot] = id;
+  re->cache_bytes += bytes;
+  return id;
+}
+
+// Called with the read lock held when the DFA lacks the state
+// reached from state 's' on byte 'c' (or the start state, if 's' is
+// negative).  Builds it under the write lock, and returns with the
+// read lock held again.  Returns -1, with the lock released, if the
+// cache was flushed by another thread in the meantime, meaning that
+// the caller must start over.
+static int extend(struct ere *re, unsigned long *gen, int s, int c) {
+  int n = -1;
+
+  pthread_rwlock_unlock(re->lock);
+  pthread_rwlock_wrlock(re->lock);
+
+  if (re->generation == *gen) {
+    int flushed = 0;
+    if (s < 0) {
+      if (re->start < 0) {
+        re->scratch->n = 0;
+        closure(re, re->scratch, re->stack, 0, 1, 0);
+        re->start = intern(re, re->scratch, &flushed);
+      }
+      n = re->start;
+    } else {
+      n = re->states[s]->next[c];
+      if (n < 0) {
+        struct ere_state *st = re->states[s];
+        step(re, st->pcs, st->len, c, re->scratch, re->stack);
+        n = intern(re, re->scratch, &flushed);
+        if (n >= 0 && !flushed) {
+          st->next[c] = n;
+        }
+      }
+    }
+    *gen = re->generation;
+  }
+
+  pthread_rwlock_unlock(re->lock);
+  pthread_rwlock_rdlock(re->lock);
+
+  if (n < 0 || re->generation != *gen) {
+    pthread_rwlock_unlock(re->lock);
+    return -1;
+  }
+  return n;
+}
+
+// Run the DFA over a line.  Returns -1 if the attempt had to be
+// abandoned because the cache was flushed.
+static int dfa_match(struct ere *re, const unsigned char *text, size_t len) {
+  pthread_rwlock_rdlock(re->lock);
+
+  unsigned long gen = re->generation;
+  int s = re->start;
+  if (s < 0 && (s = extend(re, &gen, -1, 0)) < 0) {
+    return -1;
+  }
+
+  for (size_t i = 0; i < len; i++) {
+    const struct ere_state *st = re->states[s];
+    if (st->matched || st->dead) {
+      break;
+    }
+    int n = st->next[text[i]];
+    if (n < 0 && (n = extend(re, &gen, s, text[i])) < 0) {
+      return -1;
+    }
+    s = n;
+  }
+
+  int result = re->states[s]->eol_matched;
+  pthread_rwlock_unlock(re->lock);
+  return result;
+}
+
+int ere_compile(struct ere *re, const char *pattern, int flags) {
+  memset(re, 0, sizeof(struct ere));
+  re->flags = flags;
+  re->start = -1;
+  re->cache_limit = ERE_CACHE_BYTES;
+
+  struct parser ps = {.p = pattern, .flags = flags};
+  struct node *root = parse_alt(&ps);
+  if (root != NULL && *ps.p != '\0') {
+    ps.error = "unmatched )";
+  }
+  if (ps.error != NULL) {
+    free_nodes(&ps);
+    re->error = ps.error;
+    return -1;
+  }
+
+  struct program pg = {0};
+  compile_node(&pg, root);
+  emit(&pg, OP_MATCH);
+  re->prog = pg.insts;
+  re->prog_len = pg.len;
+
+  int rc = find_literal(re, root, strlen(pattern));
+  free_nodes(&ps);
+
+  if (pg.overflow) {
+    re->error = "regular expression too large";
+    ere_free(re);
+    return -1;
+  }
+
+  // Size the hash table so that it never gets more than half full
+  // before the byte limit forces a flush.
+  re->states_capacity = (int)(re->cache_limit / sizeof(struct ere_state));
+  re->table_size = 1;
+  while (re->table_size < 2 * re->states_capacity) {
+    re->table_size *= 2;
+  }
+
+  re->lock = malloc(sizeof(pthread_rwlock_t));
+  re->states = malloc((size_t)re->states_capacity * sizeof(struct ere_state *));
+  re->table = malloc((size_t)re->table_size * sizeof(int));
+  re->scratch = pcset_new(re->prog_len);
+  re->scratch_eol = pcset_new(re->prog_len);
+  re->stack = malloc((2 * (size_t)re->prog_len + 1) * sizeof(int));
+
+  if (rc != 0 || !re->lock || !re->states || !re->table || !re->scratch ||
+      !re->scratch_eol || !re->stack) {
+    free(re->lock);
+    re->lock = NULL;
+    re->error = "out of memory";
+    ere_free(re);
+    return -1;
+  }
+
+  for (int i = 0; i < re->table_size; i++) {
+    re->table[i] = -1;
+  }
+
+  // Prefer writers: readers hold the lock for a whole line at a time,
+  // and with many worker threads a reader-preferring lock would let
+  // them starve the one thread that needs to add a state.
+  pthread_rwlockattr_t attr;
+  pthread_rwlockattr_init(&attr);
+  pthread_rwlockattr_setkind_np(&attr,
+                                PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+  if (pthread_rwlock_init(re->lock, &attr) != 0) {
+    free(re->lock);
+    re->lock = NULL;
+    re->error = "failed to initialise lock";
+    ere_free(re);
+    return -1;
+  }
+  pthread_rwlockattr_destroy(&attr);
+
+  return 0;
+}
+
+int ere_match(struct ere *re, const char *text, size_t len) {
+  if (re->literal != NULL) {
+    const char *hit = re->flags & ERE_ICASE
+                          ? search_ci(text, len, re->literal, re->literal_len)
+                          : memmem(text, len, re->literal, re->literal_len);
+    if (hit == NULL) {
+      return 0;
+    }
+    if (re->literal_only) {
+      return 1;
+    }
+  }
+
+  for (int attempt = 0; attempt < ERE_MAX_RESTARTS; attempt++) {
+    int result = dfa_match(re, (const unsigned char *)text, len);
+    if (result >= 0) {
+      return result;
+    }
+  }
+  return nfa_match(re, (const unsigned char *)text, len);
+}
+
+void ere_free(struct ere *re) {
+  if (re->lock != NULL) {
+    pthread_rwlock_destroy(re->lock);
+    free(re->lock);
+  }
+  if (re->states != NULL) {
+    for (int i = 0; i < re->num_states; i++) {
+      free(re->states[i]);
+    }
+  }
+  free(re->states);
+  free(re->table);
+  pcset_free(re->scratch);
+  pcset_free(re->scratch_eol);
+  free(re->stack);
+  free(re->prog);
+  free(re->literal);
+  memset(re, 0, sizeof(struct ere));
+}
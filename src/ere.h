@@ -0,0 +1,80 @@
+#ifndef ERE_H
+#define ERE_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+// A small POSIX-style extended regular expression engine.  Patterns
+// are compiled once into an NFA, which is then turned lazily into a
+// DFA while matching.  The DFA cache is shared by all threads matching
+// against the same 'struct ere', so work done by one worker thread
+// benefits all the others.
+//
+// Supported syntax: literals, '.', bracket expressions (including
+// ranges, negation and [:class:] names), '^', '$', grouping with
+// '(' ')', alternation with '|', and the repetition operators '*',
+// '+', '?' and '{m,n}'.  The escapes \d \w \s (and their upper case
+// complements), \t and \n are also understood.
+
+// Match ASCII letters case-insensitively.
+#define ERE_ICASE 1
+
+// Default upper bound on the memory used by the DFA cache.  When the
+// cache grows beyond this, it is flushed and rebuilt on demand.
+#define ERE_CACHE_BYTES (4 << 20)
+
+struct ere_inst;
+struct ere_state;
+struct ere_pcset;
+
+struct ere {
+  // The compiled NFA program.
+  struct ere_inst *prog;
+  int prog_len;
+  int flags;
+
+  // Longest literal that every match must contain (folded to lower
+  // case under ERE_ICASE), or NULL if there is none.  Lines not
+  // containing it are rejected without running the automaton at all.  If 'literal_only' is set, the pattern is
+  // nothing but this literal, and the automaton is never run.
+  char *literal;
+  size_t literal_len;
+  int literal_only;
+
+  // The lazily built DFA.  Everything below is protected by 'lock'.
+  // 'generation' is incremented every time the cache is flushed,
+  // which invalidates all state numbers handed out before.
+  pthread_rwlock_t *lock;
+  struct ere_state **states;
+  int num_states;
+  int states_capacity;
+  int *table;
+  int table_size;
+  int start;
+  size_t cache_bytes;
+  size_t cache_limit;
+  unsigned long generation;
+
+  // Scratch space used while building new DFA states.
+  struct ere_pcset *scratch;
+  struct ere_pcset *scratch_eol;
+  int *stack;
+
+  // Human readable description of why ere_compile() failed.
+  const char *error;
+};
+
+// Compile 'pattern' into 're'.  'flags' is zero or ERE_ICASE.
+// Returns non-zero on error, in which case 're->error' describes the
+// problem and nothing needs to be freed.
+int ere_compile(struct ere *re, const char *pattern, int flags);
+
+// Returns 1 if the 'len' bytes at 'text' (a single line, without its
+// trailing newline) contain a match, and 0 otherwise.  Safe to call
+// concurrently from any number of threads.
+int ere_match(struct ere *re, const char *text, size_t len);
+
+// Free all resources held by a compiled regex.
+void ere_free(struct ere *re);
+
+#endif
@@ -3,6 +3,7 @@
 #define _DEFAULT_SOURCE
 
 #include <assert.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -17,69 +18,94 @@
 
 #include <pthread.h>
 
+#include "ere.h"
+#include "follow.h"
+#include "grep.h"
 #include "job_queue.h"
+#include "scand.h"
+#include "shard.h"
+#include "walk.h"
 
 /*Global mutex - prints to stdout*/  
 static pthread_mutex_t print_lock = PTHREAD_MUTEX_INITIALIZER;
 
+// --partial: matches are saved here instead of printed, also under
+// 'print_lock'.
+static FILE *partial = NULL;
+
+// Some file could not be opened or read, which makes the exit status 2.
+static atomic_int failed = 0;
+
 // Struct
 struct search_queue {
   struct job_queue *job_q;
-  const char *needle;
+  struct grep grep; // needle, options and the compiled regex, if any.
+  atomic_int matched;   // Some file matched; the exit status of -q.
+  struct follow follow; // --follow: the files and directories watched.
 };
 
-/*
-fauxgrep_file_mt:
----------------------------------------------------------------
-Opens the file at 'path' reads it line-by-line, checks whether
-each line has a match for the 'needle'.
+// A file to search.  Under --follow, 'pos' records how far the search
+// got, for follow_run() to carry on from there.  Under --dedup-content,
+// 'peer' is set if the file may be a copy (see walk_duplicate()).
+// 'order' is its position in the traversal, which orders the matches
+// in partial results.
+struct grep_job {
+  char *path;
+  struct follow_pos *pos;
+  off_t size;
+  const char *peer;
+  uint64_t order;
+};
 
- - Input:
-   needle: substring to search for by each line.
-   path: filestystem path to a regular text file.
+static void free_job(void *data) {
+  struct grep_job *job = data;
+  free(job->path);
+  free(job);
+}
 
-- Output:
-  returns 0 --> succes (File is scanned, regardless if match found).
-  returns -1 --> failure (File could not be opened)
- 
+/*
+print_match:
+---------------------------------------------------------------
+The 'emit' callback for grep_file(), which searches a file
+line-by-line (see grep.c).  Each match is printed as a whole while
+holding 'print_lock', so lines from different workers never mix.
+'arg' is the job, or NULL under --follow.
 */
-int fauxgrep_file_mt(const char *needle, const char *path) {
-  FILE *file = fopen(path, "r");
-
-  if (file == NULL) {
-    warn("failed to open %s", path);
-    return -1;
-  }
-
-  char *line = NULL;
-  size_t linelen = 0;
-  int lineno = 1;
-
-  while (getline(&line, &linelen, file) != -1) {
-    // strstr() finds 'needle' as a substring anywhere in line.
-    if (strstr(line, needle) != NULL) {
-      // Locking and unlocking mutex
-      int rc = pthread_mutex_lock(&print_lock);
-      assert(rc == 0);
-      printf("%s:%d:%s", path, lineno, line);
+static void print_match(void *arg, const struct grep_match *m) {
+  struct grep_job *job = arg;
+  // Locking and unlocking mutex
+  int rc = pthread_mutex_lock(&print_lock);
+  assert(rc == 0);
+
+  if (partial != NULL)
+    grep_save(partial, job->order, m);
+  else
+    grep_print(stdout, m);
+
+  rc = pthread_mutex_unlock(&print_lock);
+  assert(rc == 0);
+}
 
-      rc = pthread_mutex_unlock(&print_lock);
-      assert(rc == 0);
-    }
-    lineno++;
-  }
-  // Cleanup of allocated ressources.
-  free(line);
-  fclose(file);
-  return 0;
+/*
+report_failure:
+---------------------------------------------------------------
+The 'fail' callback for grep_file(): warns, and remembers it for the
+exit status.
+*/
+static void report_failure(void *arg, const char *path, const char *what,
+                           int errnum) {
+  (void)arg;
+  failed = 1;
+  warnx("failed to %s %s: %s", what, path, strerror(errnum));
 }
 
 /*
 *worker_threads
 _______________________________
-Keeps dequeing (.pop) path from the job queue and runs fauxgrep_file_mt() on it.
+Keeps dequeing (.pop) path from the job queue and runs grep_file() on it.
 Popped path is freed by the worker once done.
 When job_queue_pop() indicates that theres no more work --> loop is exited and NULL is returned.
+Under -q the first match cancels the queue, which stops everyone else.
 
   
 */
@@ -88,11 +114,27 @@ void *worker_threads(void *arg) {
   struct search_queue *sq_ptr = arg;
 
   while (1) {
-    char *next_path;
-    // when job_queue_pop() == 0 --> success, calls fauxgrep_file_mt()
-    if (job_queue_pop(sq_ptr->job_q, (void **)&next_path) == 0) {
-      fauxgrep_file_mt(sq_ptr->needle, next_path);
-      free(next_path);
+    struct grep_job *job;
+    // when job_queue_pop() == 0 --> success, calls grep_file()
+    if (job_queue_pop(sq_ptr->job_q, (void **)&job) == 0) {
+      int rc;
+      if (walk_duplicate(&sq_ptr->grep.walk, job->path, job->size,
+                         job->peer))
+        rc = 0; // A copy of a file searched already.
+      else if (job->pos != NULL)
+        rc = grep_file_from(&sq_ptr->grep, job->path, job->pos, job);
+      else
+        rc = grep_file(&sq_ptr->grep, job->path, job);
+      free_job(job);
+      if (rc == 1) {
+        sq_ptr->matched = 1;
+        if (sq_ptr->grep.quiet) {
+          // The answer is known: stop the searches in progress, drop
+          // the queued paths and make the producer's next push fail.
+          sq_ptr->grep.stop = 1;
+          job_queue_cancel(sq_ptr->job_q, free_job);
+        }
+      }
     } else {
       // No more jobs to be processed
       break;
@@ -101,47 +143,181 @@ void *worker_threads(void *arg) {
   return NULL;
 }
 
+/*
+follow_scan:
+---------------------------------------------------------------
+Called by follow_run() for each file that grew or appeared after the
+initial search.  Runs in the main thread, after the workers are gone.
+*/
+static int follow_scan(void *arg, const char *path, struct follow_pos *pos) {
+  struct search_queue *sq_ptr = arg;
+
+  int rc = grep_file_from(&sq_ptr->grep, path, pos, NULL);
+  // Matches are wanted as they happen, not when a buffer fills up.
+  fflush(stdout);
+  if (rc == 1)
+    sq_ptr->matched = 1;
+  return rc == 1 && sq_ptr->grep.quiet;
+}
+
+// Orders matches as a single-threaded run would print them: by file,
+// in the order of the traversal, then by line.
+static int cmp_saved(const void *a, const void *b) {
+  const struct grep_saved *x = a, *y = b;
+  if (x->order != y->order)
+    return x->order < y->order ? -1 : 1;
+  return (x->m.lineno > y->m.lineno) - (x->m.lineno < y->m.lineno);
+}
+
+/*
+merge:
+---------------------------------------------------------------
+'fauxgrep-mt merge PARTIALS...': print the matches saved by the shards
+of a --shard run, and exit with the status a single run would have.
+The lines are the same set a single run prints, but in walk order: by
+the position of their file in the traversal, which every shard makes
+in full, then by line.  All N shards must be given, unless
+--allow-partial comes first.
+*/
+static int merge(int num_files, char *const *files) {
+  struct shard_merge sm;
+  shard_merge_init(&sm);
+  int skip = shard_merge_args(&sm, num_files, files);
+  num_files -= skip;
+  files += skip;
+  if (num_files < 1)
+    errx(1, SHARD_MERGE_USAGE);
+
+  struct grep_saved *saved = NULL;
+  size_t num_saved = 0, cap_saved = 0;
+  int how = 0;
+
+  for (int i = 0; i < num_files; i++) {
+    FILE *f = shard_merge_open(&sm, files[i], SHARD_GREP);
+    for (;;) {
+      if (num_saved == cap_saved) {
+        cap_saved = cap_saved ? 2 * cap_saved : 1024;
+        saved = realloc(saved, cap_saved * sizeof(struct grep_saved));
+        if (saved == NULL)
+          err(1, "realloc() failed");
+      }
+      int shard_how;
+      int rc = grep_load(f, &saved[num_saved], &shard_how);
+      if (rc < 0)
+        errx(1, "%s: cut short or corrupt", files[i]);
+      if (rc == 0) {
+        how |= shard_how;
+        break;
+      }
+      num_saved++;
+    }
+    fclose(f);
+  }
+  shard_merge_end(&sm);
+
+  qsort(saved, num_saved, sizeof(struct grep_saved), cmp_saved);
+  for (size_t i = 0; i < num_saved; i++) {
+    grep_print(stdout, &saved[i].m);
+    free((char *)saved[i].m.path);
+    free((char *)saved[i].m.line);
+  }
+  free(saved);
+  return grep_status(how);
+}
+
+// Of what must be the same in every shard for their partial results to
+// be merged: the needle, the options that change the output, the
+// options that choose the files, and the paths.
+static uint64_t fingerprint(const struct grep *g, int num_paths,
+                            char *const *paths) {
+  int opts[] = {g->use_regex, g->icase,     (int)g->binary,
+                g->list_files, g->max_count, g->quiet};
+  uint64_t h = shard_hash(SHARD_HASH_INIT, opts, sizeof(opts));
+  h = shard_hash(h, g->needle, g->needle_len + 1);
+  h = shard_hash_walk(h, &g->walk);
+  for (int i = 0; i < num_paths; i++)
+    h = shard_hash(h, paths[i], strlen(paths[i]) + 1);
+  return h;
+}
+
 int main(int argc, char *const *argv) {
   if (argc < 2) {
-    err(1, "usage: [-n INT] STRING paths...");
+    err(1, GREP_USAGE);
     exit(1);
   }
 
+  // Searching for "merge" takes a '--' in front of it.
+  if (strcmp(argv[1], "merge") == 0) {
+    return merge(argc - 2, argv + 2);
+  }
+
   // init default variables
   int num_threads = 1;  // default -> 1 single worker thread
-  char const *needle = argv[1]; // needle position
-  char *const *paths = &argv[2]; // path
-
-  if (argc > 3 && strcmp(argv[1], "-n") == 0) {
-    // Since atoi() simply returns zero on syntax errors, we cannot
-    // distinguish between the user entering a zero, or some
-    // non-numeric garbage.  In fact, we cannot even tell whether the
-    // given option is suffixed by garbage, i.e. '123foo' returns
-    // '123'.  A more robust solution would use strtol(), but its
-    // interface is more complicated, so here we are.
-    num_threads = atoi(argv[2]);
-
-    if (num_threads < 1) {
-      err(1, "invalid thread count: %s", argv[2]);
-    }
 
-    needle = argv[3];
-    paths = &argv[4];
+  struct search_queue sq;
+  struct search_queue *sqp = &sq;
+  sqp->matched = 0;
 
-  } else {
-    needle = argv[1];
-    paths = &argv[2];
+  // Options, then the needle, then the paths.
+  int first_path = grep_parse(&sqp->grep, argc, argv, &num_threads);
+  if (first_path < 0) {
+    errx(1, "%s", sqp->grep.error);
   }
+  char *const *paths = &argv[first_path]; // path
+  const struct shard *shard = &sqp->grep.shard;
+
+  if (shard->num > 0 || sqp->grep.partial != NULL) {
+    // A partial result is only complete once the run is.
+    if (sqp->grep.follow)
+      errx(1, "--shard and --partial cannot be combined with --follow");
+    // Copies may be searched by different shards, each not knowing
+    // of the other.
+    if (shard->num > 0 && sqp->grep.walk.dedup_content)
+      errx(1, "--dedup-content cannot be combined with --shard");
+
+    if (sqp->grep.partial != NULL) {
+      struct shard_header h = {SHARD_GREP, *shard, 0};
+      h.fingerprint = fingerprint(&sqp->grep, argc - first_path, paths);
+      if (shard->num == 0)
+        h.shard.num = 1;
+      partial = shard_create(sqp->grep.partial, &h);
+      if (partial == NULL)
+        err(1, "cannot create %s", sqp->grep.partial);
+    }
+  } else if (!sqp->grep.follow) {
+    // Hand the whole request to a running scan-daemon, if there is one.
+    // Following files is for the long run, so that is done here.
+    int status = scand_forward("grep", argc, argv, 0, NULL);
+    if (status >= 0) {
+      grep_free(&sqp->grep);
+      return status;
+    }
+  } else if (sqp->grep.walk.dedup_content) {
+    // Followed files change, and with them whether they are copies.
+    errx(1, "--dedup-content cannot be combined with --follow");
+  } else if (follow_init(&sqp->follow) != 0) {
+    err(1, "cannot set up inotify");
+  }
+  sqp->follow.walk = &sqp->grep.walk;
+
+  // Compile the regex once; the worker threads share it, including
+  // the DFA it builds up while matching.
+  struct ere re;
+  if (sqp->grep.use_regex) {
+    int flags = sqp->grep.icase ? ERE_ICASE : 0;
+    if (ere_compile(&re, sqp->grep.needle, flags) != 0) {
+      errx(1, "invalid regex '%s': %s", sqp->grep.needle, re.error);
+    }
+    sqp->grep.re = &re;
+  }
+  sqp->grep.emit = print_match;
+  sqp->grep.fail = report_failure;
 
   //  Initialise the job queue and some worker threads here.
 
   struct job_queue job_q;
   job_queue_init(&job_q, 64);
-
-  struct search_queue sq;
-  struct search_queue *sqp = &sq;
   sqp->job_q = &job_q;
-  sqp->needle = needle;
 
   /* 
   Starting worker threads
@@ -174,18 +350,43 @@ int main(int argc, char *const *argv) {
   // Traversing the directory tree
   // Iterating entries, push regular files as jobs
   FTSENT *p;
-  while ((p = fts_read(ftsp)) != NULL) {
+  uint64_t order = 0;
+  // 'stop' rather than the queue's own flag, which is only safe to
+  // read under its lock; it is set before the queue is cancelled.
+  while (!sqp->grep.stop && (p = fts_read(ftsp)) != NULL) {
+    // Pruned directories are never descended into.
+    if (!walk_visit(&sqp->grep.walk, ftsp, p))
+      continue;
     switch (p->fts_info) {
     case FTS_D:
+      if (sqp->grep.follow && follow_add_dir(&sqp->follow, p->fts_path) != 0)
+        warn("cannot watch %s", p->fts_path);
       break;
     case FTS_F: {   // regular file --> enqueue a job
-      char *copy = strdup(p->fts_path);
-      if (!copy)
+      // Every shard walks the whole tree, so all agree on the order.
+      uint64_t this_order = order++;
+      if (!shard_owns(shard, p->fts_path, 0))
+        break;
+      struct follow_pos *pos = NULL;
+      if (sqp->grep.follow) {
+        pos = follow_add_file(&sqp->follow, p->fts_path, p->fts_statp,
+                              p->fts_level == FTS_ROOTLEVEL);
+        if (pos == NULL)
+          break;
+      }
+      struct grep_job *job = malloc(sizeof(struct grep_job));
+      if (!job || !(job->path = strdup(p->fts_path)))
         err(1, "strdup failed");
+      job->pos = pos;
+      job->size = p->fts_statp->st_size;
+      job->peer = sqp->grep.walk.peer;
+      job->order = this_order;
       // Pushing the job. On failure --> give warning and free allocated ressources.  
-      if (job_queue_push(sqp->job_q, copy) != 0) {
-        warn("job_queue_push failed");
-        free(copy);
+      // A cancelled queue is not a failure: -q has found its match.
+      if (job_queue_push(sqp->job_q, job) != 0) {
+        if (!sqp->grep.stop)
+          warn("job_queue_push failed");
+        free_job(job);
       }
       break;
     }
@@ -199,7 +400,7 @@ int main(int argc, char *const *argv) {
 
 
   // shutting down job queue and worker threads.
-  job_queue_destroy(sqp->job_q);
+  job_queue_close(sqp->job_q);
 
   // Awaiting for all workers to finish current jobs and exit
   for (int i = 0; i < num_threads; i++) {
@@ -209,5 +410,32 @@ int main(int argc, char *const *argv) {
   }
 
   free(threads);
-  return 0;
+  job_queue_destroy(sqp->job_q);
+
+  // Then keep going with what changes, until -q has its match.
+  if (sqp->grep.follow) {
+    fflush(stdout);
+    if (!(sqp->grep.quiet && sqp->matched) &&
+        follow_run(&sqp->follow, follow_scan, sqp) != 0)
+      err(1, "following files failed");
+    follow_destroy(&sqp->follow);
+  }
+
+  // Like grep, -q answers through the exit status, and errors make it
+  // 2 unless -q has its match.
+  int how = (sqp->grep.quiet ? GREP_QUIET : 0) |
+            (sqp->matched ? GREP_MATCHED : 0) | (failed ? GREP_FAILED : 0);
+  int status = grep_status(how);
+
+  if (partial != NULL) {
+    grep_save_end(partial, how);
+    int failed = ferror(partial);
+    if (fclose(partial) != 0 || failed)
+      err(1, "cannot write %s", sqp->grep.partial);
+  }
+
+  if (sqp->grep.re != NULL)
+    ere_free(&re);
+  grep_free(&sqp->grep);
+  return status;
 }
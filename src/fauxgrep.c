@@ -15,8 +15,11 @@
 // very handy.
 #include <err.h>
 
+#include "input.h"
+#include "walk.h"
+
 int fauxgrep_file(char const *needle, char const *path) {
-  FILE *f = fopen(path, "r");
+  FILE *f = input_open(path, INPUT_IO_STDIO);
 
   if (f == NULL) {
     warn("failed to open %s", path);
@@ -42,13 +45,28 @@ int fauxgrep_file(char const *needle, char const *path) {
 }
 
 int main(int argc, char *const *argv) {
-  if (argc < 2) {
-    err(1, "usage: STRING paths...");
-    exit(1);
+  struct walk walk;
+  walk_init(&walk);
+
+  int i = 1;
+  while (i < argc) {
+    const char *error;
+    int taken = walk_parse(&walk, argc, argv, i, &error);
+    if (taken < 0) {
+      errx(1, "%s", error);
+    }
+    if (taken == 0) {
+      break;
+    }
+    i += taken;
   }
 
-  char const *needle = argv[1];
-  char *const *paths = &argv[2];
+  if (i >= argc) {
+    errx(1, "usage: " WALK_USAGE " STRING paths...");
+  }
+
+  char const *needle = argv[i];
+  char *const *paths = &argv[i + 1];
 
   // FTS_LOGICAL = follow symbolic links
   // FTS_NOCHDIR = do not change the working directory of the process
@@ -65,11 +83,17 @@ int main(int argc, char *const *argv) {
 
   FTSENT *p;
   while ((p = fts_read(ftsp)) != NULL) {
+    if (!walk_visit(&walk, ftsp, p)) {
+      continue;
+    }
     switch (p->fts_info) {
     case FTS_D:
       break;
     case FTS_F:
-      fauxgrep_file(needle, p->fts_path);
+      if (!walk_duplicate(&walk, p->fts_path, p->fts_statp->st_size,
+                          walk.peer)) {
+        fauxgrep_file(needle, p->fts_path);
+      }
       break;
     default:
       break;
@@ -77,6 +101,7 @@ int main(int argc, char *const *argv) {
   }
 
   fts_close(ftsp);
+  walk_free(&walk);
 
   return 0;
 }
@@ -10,7 +10,9 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <fcntl.h>
 #include <fts.h>
+#include <time.h>
 
 #include "job_queue.h"
 
@@ -23,9 +25,26 @@ pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 // very handy.
 #include <err.h>
 
-#include "histogram.h"
+#include "follow.h"
+#include "input.h"
+#include "scand.h"
+#include "shard.h"
+#include "stats.h"
+#include "walk.h"
 
-int global_histogram[8] = { 0 };
+// How much is read (and merged into the global totals) at a time.
+#define FHISTOGRAM_BLOCK (64 * 1024)
+
+// Compressed files made of independent members are handed out to the
+// workers in pieces of about this many compressed bytes.
+#define FHISTOGRAM_CHUNK (4 << 20)
+
+// Under --shard, big plain files are dealt out to the shards in pieces
+// of this many bytes.
+#define FHISTOGRAM_PIECE (64 << 20)
+
+// Everything merged so far, protected by 'mutex'.
+struct stats global_stats;
 
 struct job_queue queue;
 
@@ -35,84 +54,518 @@ struct thread_args {
     int naptime;
 };
 
-int fhistogram_mt(char const* path) {
-    FILE* f = fopen(path, "r");
+// A file, or a range of the members of a compressed file.  Under
+// --follow, 'pos' records how much of the file has been read.  Under
+// --dedup-content, 'peer' is set if the file may be a copy.
+struct job {
+    char *path;
+    int whole;
+    struct input_range range;
+    struct follow_pos *pos;
+    off_t size;
+    const char *peer; // --dedup-content: see walk_duplicate().
+};
 
-    int local_histogram[8] = { 0 };
+// --follow: the files and directories watched.
+struct follow follow;
 
-    if (f == NULL) {
+// --sample: every block has a chance of 1/'sample_every' to be read.
+// Zero if everything is read.
+int64_t sample_every = 0;
+uint64_t sample_seed;
+
+// --io: how files are read.
+enum input_io io_mode = INPUT_IO_STDIO;
+
+// The traversal options, and what has been visited.
+struct walk *walk;
+
+// --shard: which files, and pieces of files, are ours.
+struct shard *shard;
+
+// Redraws the bit histogram of 'global_stats'.  Call with 'mutex' held.
+static void show_global(void) {
+    if (global_stats.which & STATS_BITS) {
+        if (sample_every > 0) {
+            stats_print_bits_ci(&global_stats);
+        } else {
+            int64_t bits[8];
+            stats_bits(&global_stats, bits);
+            stats_print_bits(bits);
+        }
+    }
+}
+
+// SplitMix64: small, fast, and good enough to pick blocks with.
+static uint64_t next_random(uint64_t *state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// Seeds the choice of blocks in 'path' from the path and the --seed
+// alone, so that a run can be repeated exactly, whichever thread
+// happens to get which file.
+static uint64_t path_seed(const char *path) {
+    uint64_t h = 0xcbf29ce484222325ULL; // FNV-1a
+    for (const char *p = path; *p != '\0'; p++) {
+        h = (h ^ (unsigned char)*p) * 0x100000001b3ULL;
+    }
+    return h ^ sample_seed;
+}
+
+// Accounts for 'local', one file picked as a whole, in the global
+// estimates.
+static void add_sample(struct stats *local) {
+    pthread_mutex_lock(&mutex);
+    stats_add_sample(local, &global_stats, sample_every);
+    show_global();
+    pthread_mutex_unlock(&mutex);
+}
+
+// Accounts for 'local', the block picked in a stratum, in the global
+// estimates.
+static void add_stratum(struct stats *local) {
+    pthread_mutex_lock(&mutex);
+    stats_add_stratum(local, &global_stats, sample_every);
+    show_global();
+    pthread_mutex_unlock(&mutex);
+}
+
+// --sample: reads a sample of the blocks of 'path'.  The file is cut
+// into strata of 'sample_every' blocks, and one position is drawn in
+// each; a position past the end of the file reads nothing.  Every
+// block is thus read with the same chance, however small its file,
+// and the blocks read are spread evenly over big files.  Strata are
+// paired within the file, so the estimates do not depend on which
+// thread reads which file.
+int fhistogram_sample(const char *path) {
+    uint64_t rng = path_seed(path);
+    struct stats *local = malloc(sizeof(struct stats));
+    unsigned char *block = malloc(FHISTOGRAM_BLOCK);
+    if (local == NULL || block == NULL) {
+        err(1, "malloc() failed");
+    }
+    stats_init(local, global_stats.which);
+
+    if (input_probe(path) != INPUT_PLAIN) {
+        // Compressed data cannot be read at an offset, so such files
+        // are sampled as a whole.
+        if (next_random(&rng) % (uint64_t)sample_every == 0) {
+            FILE* f = input_open(path, io_mode);
+            size_t n;
+            if (f == NULL) {
+                fflush(stdout);
+                warn("failed to open %s", path);
+            } else {
+                while ((n = fread(block, 1, FHISTOGRAM_BLOCK, f)) > 0) {
+                    stats_update(local, block, n);
+                }
+                fclose(f);
+                add_sample(local);
+            }
+        }
+        free(block);
+        free(local);
+        return 0;
+    }
+
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
         fflush(stdout);
         warn("failed to open %s", path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        free(block);
+        free(local);
         return -1;
     }
 
-    int i = 0;
-    
-    char c;
-    while (fread(&c, sizeof(c), 1, f) == 1) {
-        i++;
-        update_histogram(local_histogram, c);
-        if ((i % 100000) == 0) {
-            pthread_mutex_lock(&mutex);
-            merge_histogram(local_histogram, global_histogram);
-            pthread_mutex_unlock(&mutex);
-
-            pthread_mutex_lock(&mutex);
-            print_histogram(global_histogram);
-            pthread_mutex_unlock(&mutex);
+    int64_t num_blocks = (st.st_size + FHISTOGRAM_BLOCK - 1) / FHISTOGRAM_BLOCK;
+    for (int64_t stratum = 0; stratum < num_blocks; stratum += sample_every) {
+        int64_t pick = stratum + (int64_t)(next_random(&rng) %
+                                           (uint64_t)sample_every);
+        if (pick >= num_blocks) {
+            // Nothing there, which counts as much as anything else.
+            add_stratum(local);
+            continue;
+        }
+
+        ssize_t n = pread(fd, block, FHISTOGRAM_BLOCK,
+                          (off_t)pick * FHISTOGRAM_BLOCK);
+        if (n < 0) {
+            fflush(stdout);
+            warn("failed to read %s", path);
+            break;
+        }
+        if (io_mode != INPUT_IO_STDIO) {
+            // The blocks are too scattered for O_DIRECT or readahead to
+            // help, but they need not stay in the page cache either.
+            posix_fadvise(fd, (off_t)pick * FHISTOGRAM_BLOCK, n,
+                          POSIX_FADV_DONTNEED);
         }
+        stats_update(local, block, (size_t)n);
+        add_stratum(local);
     }
-    fclose(f);
-    
+
     pthread_mutex_lock(&mutex);
-    merge_histogram(local_histogram, global_histogram);
+    stats_end_strata(local, &global_stats, sample_every);
     pthread_mutex_unlock(&mutex);
 
+    close(fd);
+    free(block);
+    free(local);
+    return 0;
+}
+
+int fhistogram_mt(const struct job *job) {
+    const char *path = job->path;
+    FILE* f = job->whole ? input_open(path, io_mode)
+                         : input_open_range(path, &job->range, io_mode);
+
+    if (f == NULL) {
+        fflush(stdout);
+        warn("failed to open %s", path);
+        return -1;
+    }
+
+    // Only plain files are continued (see follow.h), so this works.
+    if (job->pos != NULL && job->pos->offset > 0 &&
+        fseeko(f, job->pos->offset, SEEK_SET) != 0) {
+        fflush(stdout);
+        warn("failed to seek in %s", path);
+        fclose(f);
+        return -1;
+    }
+
+    // Both are a bit large for the stack of a worker thread.
+    struct stats *local = malloc(sizeof(struct stats));
+    unsigned char *block = malloc(FHISTOGRAM_BLOCK);
+    if (local == NULL || block == NULL) {
+        err(1, "malloc() failed");
+    }
+    stats_init(local, global_stats.which);
+    stats_begin_file(local);
+
+    // Every statistic is fed from the same block, so the file is read
+    // once no matter how many are asked for.
+    size_t n;
+    while ((n = fread(block, 1, FHISTOGRAM_BLOCK, f)) > 0) {
+        stats_update(local, block, n);
+        if (job->pos != NULL) {
+            job->pos->offset += (off_t)n;
+        }
+
+        pthread_mutex_lock(&mutex);
+        stats_merge(local, &global_stats);
+        show_global();
+        pthread_mutex_unlock(&mutex);
+    }
+    if (ferror(f)) {
+        fflush(stdout);
+        warn("failed to read %s", path);
+    }
+    fclose(f);
+    stats_end_file(local);
+
     pthread_mutex_lock(&mutex);
-    print_histogram(global_histogram);
+    stats_merge(local, &global_stats);
+    show_global();
     pthread_mutex_unlock(&mutex);
-    
+
+    free(block);
+    free(local);
     return 0;
 
 }
 
 void* thread(void* arg) { //void* p
     struct thread_args* args = (struct thread_args*) arg;
-    char* path;
-    while (job_queue_pop(&queue, (void*)&path) == 0) {
-        fhistogram_mt(path);
-        free(path);
+    struct job* job;
+    while (job_queue_pop(&queue, (void*)&job) == 0) {
+        if (walk_duplicate(walk, job->path, job->size, job->peer)) {
+            // A copy of a file read already.
+        } else if (sample_every > 0) {
+            fhistogram_sample(job->path);
+        } else {
+            fhistogram_mt(job);
+        }
+        free(job->path);
+        free(job);
     }
     return NULL;
 }
 
+static void push_job(const char *path, const struct input_range *range,
+                     struct follow_pos *pos, off_t size, const char *peer) {
+    struct job* job = calloc(1, sizeof(struct job));
+    if (job == NULL || (job->path = strdup(path)) == NULL) {
+        err(1, "malloc() failed");
+    }
+    job->whole = range == NULL;
+    if (range != NULL) {
+        job->range = *range;
+    }
+    job->pos = pos;
+    job->size = size;
+    job->peer = peer;
+    job_queue_push(&queue, job);
+}
+
+// Cuts a plain file of 'size' bytes into pieces of FHISTOGRAM_PIECE
+// bytes.  The last one reads up to the end, wherever that is by then.
+static int split_plain(off_t size, struct input_range **ranges) {
+    int n = (int)((size + FHISTOGRAM_PIECE - 1) / FHISTOGRAM_PIECE);
+    *ranges = malloc((size_t)n * sizeof(struct input_range));
+    if (*ranges == NULL) {
+        err(1, "malloc() failed");
+    }
+    for (int i = 0; i < n; i++) {
+        off_t offset = (off_t)i * FHISTOGRAM_PIECE;
+        (*ranges)[i] = (struct input_range){INPUT_PLAIN, offset,
+                                            i < n - 1 ? FHISTOGRAM_PIECE : -1};
+    }
+    return n;
+}
+
+// Queue the file at 'path'.  A big compressed file whose members can
+// be decompressed independently is queued as several jobs, so that
+// all workers help with it.  Not when hashing, since the hash of a
+// file is computed front to back, nor when following, which wants the
+// position in the file, nor when it may be a copy of another ('peer'),
+// which is decided once for the whole file, nor when sampling.
+//
+// Under --shard, only the pieces that are ours are queued, and big
+// plain files are cut into pieces as well.  Returns the number of
+// jobs queued.
+static int queue_file(const char *path, off_t size, struct follow_pos *pos,
+                      const char *peer) {
+    struct input_range *ranges = NULL;
+    int n = 0;
+    int queued = 0;
+
+    int splittable = !(global_stats.which & STATS_HASH) && pos == NULL &&
+                     peer == NULL && sample_every == 0;
+    if (splittable && size > 2 * FHISTOGRAM_CHUNK) {
+        n = input_split(path, FHISTOGRAM_CHUNK, &ranges);
+    }
+    if (n == 0 && splittable && shard->num > 0 &&
+        size > 2 * FHISTOGRAM_PIECE && input_probe(path) == INPUT_PLAIN) {
+        n = split_plain(size, &ranges);
+    }
+    if (n <= 0 && shard_owns(shard, path, 0)) {
+        push_job(path, NULL, pos, size, peer);
+        queued++;
+    }
+    for (int i = 0; i < n; i++) {
+        if (shard_owns(shard, path, (uint64_t)i)) {
+            push_job(path, &ranges[i], NULL, size, NULL);
+            queued++;
+        }
+    }
+    free(ranges);
+    return queued;
+}
+
+// Whether scan-daemon sent its final totals, now in 'global_stats'.
+static int forwarded = 0;
+
+// Draws what scan-daemon streams back the way a local run draws its
+// own: the bit counts as they grow, and then the final totals, which
+// main() shows with show_global() and show_totals().
+static void show_forwarded(int type, const void *data, size_t len) {
+    if (type == SCAND_HISTOGRAM && len == 8 * sizeof(int64_t)) {
+        int64_t bits[8];
+        memcpy(bits, data, sizeof(bits));
+        stats_print_bits(bits);
+    } else if (type == SCAND_STATS) {
+        FILE *in = fmemopen((void *)data, len, "rb");
+        if (in != NULL) {
+            forwarded = stats_load(in, &global_stats) == 0;
+            fclose(in);
+        }
+    }
+}
+
+// Under --follow, the histogram is redrawn in place, and the other
+// statistics are printed below it after every update.
+static void show_update(void) {
+    if (global_stats.which & ~STATS_BITS) {
+        if (global_stats.which & STATS_BITS) {
+            stats_move_lines(9);
+        }
+        stats_report(stdout, &global_stats);
+        printf("\n");
+    }
+    fflush(stdout);
+}
+
+// Called by follow_run() for each file that grew or appeared after the
+// initial scan, in the main thread.
+static int follow_scan(void *arg, const char *path, struct follow_pos *pos) {
+    (void)arg;
+    struct job job = {(char *)path, 1, {INPUT_PLAIN, 0, 0}, pos, 0, NULL};
+
+    fhistogram_mt(&job);
+    show_update();
+    return 0;
+}
+
+// What is left to print once everything has been read, the histogram
+// having been drawn by show_global().
+static void show_totals(void) {
+  if (global_stats.which & STATS_BITS) {
+    stats_move_lines(9);
+  }
+  if (sample_every > 0) {
+    printf("Read %lld bytes, about 1 block in %lld (--seed %llu).\n",
+           (long long)global_stats.sampled, (long long)sample_every,
+           (unsigned long long)sample_seed);
+  }
+
+  // The other statistics have no running display; they are printed
+  // once everything has been read.
+  if (global_stats.which & ~STATS_BITS) {
+    stats_report(stdout, &global_stats);
+  }
+}
+
+// 'fhistogram-mt merge PARTIALS...': add up the totals saved by the
+// shards of a --shard run, and show them as a single run would have
+// at the end.  All N shards must be given, unless --allow-partial
+// comes first.
+static int merge(int num_files, char * const *files) {
+  struct shard_merge sm;
+  shard_merge_init(&sm);
+  int skip = shard_merge_args(&sm, num_files, files);
+  num_files -= skip;
+  files += skip;
+  if (num_files < 1) {
+    errx(1, SHARD_MERGE_USAGE);
+  }
+
+  struct stats *partial = malloc(sizeof(struct stats));
+  if (partial == NULL) {
+    err(1, "malloc() failed");
+  }
+
+  for (int i = 0; i < num_files; i++) {
+    FILE *f = shard_merge_open(&sm, files[i], SHARD_HISTOGRAM);
+    uint64_t every, seed;
+    if (stats_load(f, partial) != 0 || shard_get(f, &every) != 0 ||
+        shard_get(f, &seed) != 0) {
+      errx(1, "%s: cut short or corrupt", files[i]);
+    }
+    fclose(f);
+
+    // The options agree (see fingerprint()), so these do too.
+    if (i == 0) {
+      stats_init(&global_stats, partial->which);
+      sample_every = (int64_t)every;
+      sample_seed = seed;
+    }
+    stats_merge(partial, &global_stats);
+  }
+  shard_merge_end(&sm);
+  free(partial);
+
+  show_global();
+  show_totals();
+  return 0;
+}
+
+// Of what must be the same in every shard for their partial results to
+// be merged: the statistics, the sampling, the options that choose
+// the files, and the paths.
+static uint64_t fingerprint(const struct walk *w, int num_paths,
+                            char * const *paths) {
+  uint64_t opts[] = {global_stats.which, (uint64_t)sample_every,
+                     sample_every > 0 ? sample_seed : 0};
+  uint64_t h = shard_hash(SHARD_HASH_INIT, opts, sizeof(opts));
+  h = shard_hash_walk(h, w);
+  for (int i = 0; i < num_paths; i++) {
+    h = shard_hash(h, paths[i], strlen(paths[i]) + 1);
+  }
+  return h;
+}
+
 int main(int argc, char * const *argv) {
   if (argc < 2) {
     err(1, "usage: paths...");
     exit(1);
   }
 
-  int num_threads = 1;
-  char * const *paths = &argv[1];
-
-  if (argc > 3 && strcmp(argv[1], "-n") == 0) {
-    // Since atoi() simply returns zero on syntax errors, we cannot
-    // distinguish between the user entering a zero, or some
-    // non-numeric garbage.  In fact, we cannot even tell whether the
-    // given option is suffixed by garbage, i.e. '123foo' returns
-    // '123'.  A more robust solution would use strtol(), but its
-    // interface is more complicated, so here we are.
-    num_threads = atoi(argv[2]);
+  // A directory called "merge" takes a '--' in front of it.
+  if (strcmp(argv[1], "merge") == 0) {
+    return merge(argc - 2, argv + 2);
+  }
 
-    if (num_threads < 1) {
-      err(1, "invalid thread count: %s", argv[2]);
+  struct stats_args options;
+  const char *error;
+  int first = stats_parse_args(argc, argv, &options, &error);
+  if (first < 0) {
+    errx(1, "%s", error);
+  }
+  char * const *paths = &argv[first];
+  int num_threads = options.num_threads;
+  int following = options.follow;
+  unsigned which = options.which;
+  stats_init(&global_stats, which);
+  io_mode = options.io;
+
+  if (options.sample > 0) {
+    // The rate is rounded to one block in so many.
+    sample_every = (int64_t)(1 / options.sample + 0.5);
+    sample_seed = options.seeded ? options.seed
+                                 : (uint64_t)time(NULL) ^ (uint64_t)getpid();
+    if (which & STATS_HASH) {
+      errx(1, "-s hash cannot be combined with --sample");
     }
+  }
 
-    paths = &argv[3];
-  } else {
-    paths = &argv[1];
+  shard = &options.shard;
+  int sharded = shard->num > 0 || options.partial != NULL;
+  if (sharded && following) {
+    // A partial result is only complete once the run is.
+    errx(1, "--shard and --partial cannot be combined with --follow");
+  }
+  if (shard->num > 0 && options.walk.dedup_content) {
+    // Copies may be read by different shards, each not knowing of the
+    // other.
+    errx(1, "--dedup-content cannot be combined with --shard");
+  }
+  if (shard->num > 0 && sample_every > 0 && !options.seeded) {
+    // Otherwise each shard would draw with a seed of its own.
+    errx(1, "--sample needs --seed when combined with --shard");
   }
 
+  // Hand the whole request to a running scan-daemon, if there is one.
+  // Following, sampling and sharding are done here.
+  if (!following && sample_every == 0 && !sharded) {
+    int status = scand_forward("histogram", argc, argv, 0, show_forwarded);
+    if (status >= 0) {
+      if (forwarded) {
+        show_global();
+        show_totals();
+      }
+      walk_free(&options.walk);
+      return status;
+    }
+  } else if (following && (which & STATS_HASH)) {
+    // The hash of a file is only defined once it stops growing.
+    errx(1, "-s hash cannot be combined with --follow");
+  } else if (following && options.walk.dedup_content) {
+    // Followed files change, and with them whether they are copies.
+    errx(1, "--dedup-content cannot be combined with --follow");
+  } else if (following && follow_init(&follow) != 0) {
+    err(1, "cannot set up inotify");
+  }
+  walk = &options.walk;
+  follow.walk = walk;
+
   //Init job queue and threads
   int capacity = 64;
   job_queue_init(&queue, capacity);
@@ -145,35 +598,81 @@ int main(int argc, char * const *argv) {
 
   FTSENT *p;
   while ((p = fts_read(ftsp)) != NULL) {
+    // Pruned directories are never descended into.
+    if (!walk_visit(walk, ftsp, p)) {
+      continue;
+    }
     switch (p->fts_info) {
     case FTS_D:
+      if (following && follow_add_dir(&follow, p->fts_path) != 0) {
+        warn("cannot watch %s", p->fts_path);
+      }
       break;
-    case FTS_F:
+    case FTS_F: {
+      struct follow_pos *pos = NULL;
+      if (following) {
+        pos = follow_add_file(&follow, p->fts_path, p->fts_statp,
+                              p->fts_level == FTS_ROOTLEVEL);
+        if (pos == NULL) {
+          break;
+        }
+      }
       //Processing the file p->fts_path.
+      if (queue_file(p->fts_path, p->fts_statp->st_size, pos,
+                     walk->peer) > 0) {
         printf("Queued file: %s\n", p->fts_path);
-        job_queue_push(&queue, strdup(p->fts_path));
+      }
       break;
+    }
     default:
       break;
     }
   }
   fts_close(ftsp);
 
-  //Destorys mutex and job queue
-  pthread_mutex_destroy(&mutex);
-  job_queue_destroy(&queue);
+  //Closes the job queue
+  job_queue_close(&queue);
 
-  //Join the threads
+  //Join the threads, then destroy the queue they no longer use
   for (int j = 0; j < num_threads; j++) {
       if (pthread_join(ptids[j], NULL) != 0) {
           err(1, "pthread_join failed");
       }
   }
-  pthread_mutex_lock(&mutex);
-  print_histogram(global_histogram);
-  pthread_mutex_unlock(&mutex);
+  job_queue_destroy(&queue);
+  show_global();
+
+  // Then keep updating with what changes.  Does not return unless
+  // inotify fails.
+  if (following) {
+    show_update();
+    if (follow_run(&follow, follow_scan, NULL) != 0) {
+      err(1, "following files failed");
+    }
+    follow_destroy(&follow);
+  }
+
+  show_totals();
 
-  move_lines(9);
+  if (options.partial != NULL) {
+    struct shard_header h = {SHARD_HISTOGRAM, *shard, 0};
+    h.fingerprint = fingerprint(&options.walk, argc - first, paths);
+    if (h.shard.num == 0) {
+      h.shard.num = 1;
+    }
+    FILE *out = shard_create(options.partial, &h);
+    if (out == NULL) {
+      err(1, "cannot create %s", options.partial);
+    }
+    stats_save(out, &global_stats);
+    shard_put(out, (uint64_t)sample_every);
+    shard_put(out, sample_seed);
+    int failed = ferror(out);
+    if (fclose(out) != 0 || failed) {
+      err(1, "cannot write %s", options.partial);
+    }
+  }
 
+  walk_free(&options.walk);
   return 0;
 }
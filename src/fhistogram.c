@@ -17,11 +17,13 @@
 #include <err.h>
 
 #include "histogram.h"
+#include "input.h"
+#include "walk.h"
 
 int global_histogram[8] = { 0 };
 
 int fhistogram(char const *path) {
-  FILE *f = fopen(path, "r");
+  FILE *f = input_open(path, INPUT_IO_STDIO);
 
   int local_histogram[8] = { 0 };
 
@@ -31,16 +33,16 @@ int fhistogram(char const *path) {
     return -1;
   }
 
-  int i = 0;
-
-  char c;
-  while (fread(&c, sizeof(c), 1, f) == 1) {
-    i++;
-    update_histogram(local_histogram, c);
-    if ((i % 100000) == 0) {
-      merge_histogram(local_histogram, global_histogram);
-      print_histogram(global_histogram);
+  // Reading a block at a time rather than a byte at a time keeps
+  // stdio's locking and bookkeeping out of the inner loop.
+  unsigned char block[65536];
+  size_t n;
+  while ((n = fread(block, 1, sizeof(block), f)) > 0) {
+    for (size_t i = 0; i < n; i++) {
+      update_histogram(local_histogram, block[i]);
     }
+    merge_histogram(local_histogram, global_histogram);
+    print_histogram(global_histogram);
   }
 
   fclose(f);
@@ -52,12 +54,27 @@ int fhistogram(char const *path) {
 }
 
 int main(int argc, char * const *argv) {
-  if (argc < 2) {
-    err(1, "usage: paths...");
-    exit(1);
+  struct walk walk;
+  walk_init(&walk);
+
+  int i = 1;
+  while (i < argc) {
+    const char *error;
+    int taken = walk_parse(&walk, argc, argv, i, &error);
+    if (taken < 0) {
+      errx(1, "%s", error);
+    }
+    if (taken == 0) {
+      break;
+    }
+    i += taken;
   }
 
-  char * const *paths = &argv[1];
+  if (i >= argc) {
+    errx(1, "usage: " WALK_USAGE " paths...");
+  }
+
+  char * const *paths = &argv[i];
 
   // FTS_LOGICAL = follow symbolic links
   // FTS_NOCHDIR = do not change the working directory of the process
@@ -74,11 +91,17 @@ int main(int argc, char * const *argv) {
 
   FTSENT *p;
   while ((p = fts_read(ftsp)) != NULL) {
+    if (!walk_visit(&walk, ftsp, p)) {
+      continue;
+    }
     switch (p->fts_info) {
     case FTS_D:
       break;
     case FTS_F:
-      fhistogram(p->fts_path);
+      if (!walk_duplicate(&walk, p->fts_path, p->fts_statp->st_size,
+                          walk.peer)) {
+        fhistogram(p->fts_path);
+      }
       break;
     default:
       break;
@@ -86,6 +109,7 @@ int main(int argc, char * const *argv) {
   }
 
   fts_close(ftsp);
+  walk_free(&walk);
 
   move_lines(9);
 
@@ -0,0 +1,18 @@
+// This header file contains not just function prototypes, but also
+// the definitions.  This means it does not need to be compiled
+// separately.  It is shared by fibs and scan-daemon.
+
+#ifndef FIB_H
+#define FIB_H
+
+// A simple recursive (inefficient) implementation of the Fibonacci
+// function.
+static int fib(int n) {
+  if (n < 2) {
+    return 1;
+  } else {
+    return fib(n - 1) + fib(n - 2);
+  }
+}
+
+#endif
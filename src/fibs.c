@@ -23,23 +23,15 @@
 // very handy.
 #include <err.h>
 
+#include "fib.h"
 #include "job_queue.h"
+#include "scand.h"
 
 // Whenever we print to the screen, we will first lock this mutex.
 // This ensures that multiple threads do not try to print
 // concurrently.
 pthread_mutex_t stdout_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-// A simple recursive (inefficient) implementation of the Fibonacci
-// function.
-int fib(int n) {
-  if (n < 2) {
-    return 1;
-  } else {
-    return fib(n - 1) + fib(n - 2);
-  }
-}
-
 // This function converts a line to an integer, computes the
 // corresponding Fibonacci number, then prints the result to the
 // screen.
@@ -75,6 +67,13 @@ void *worker(void *arg) {
 int main(int argc, char *const *argv) {
   int num_threads = 1;
 
+  // Hand the whole request, standard input included, to a running
+  // scan-daemon, if there is one.
+  int status = scand_forward("fib", argc, argv, 1, NULL);
+  if (status >= 0) {
+    return status;
+  }
+
   if (argc == 3 && strcmp(argv[1], "-n") == 0) {
     // Since atoi() simply returns zero on syntax errors, we cannot
     // distinguish between the user entering a zero, or some
@@ -110,8 +109,8 @@ int main(int argc, char *const *argv) {
   }
   free(line);
 
-  // Destroy the queue.
-  job_queue_destroy(&jq);
+  // Close the queue.
+  job_queue_close(&jq);
 
   // Wait for all threads to finish.  This is important, at some may
   // still be working on their job.
@@ -121,4 +120,7 @@ int main(int argc, char *const *argv) {
     }
   }
   free(threads);
+
+  // Nobody uses the queue any more.
+  job_queue_destroy(&jq);
 }
@@ -0,0 +1,469 @@
+// Setting _DEFAULT_SOURCE is necessary to activate visibility of
+// certain header file contents on GNU/Linux systems.
+#define _DEFAULT_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fts.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+// err.h contains various nonstandard BSD extensions, but they are
+// very handy.
+#include <err.h>
+
+#include "follow.h"
+#include "input.h"
+
+// What we want to hear about in a watched directory.
+#define FOLLOW_EVENTS                                                    \
+  (IN_CREATE | IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | \
+   IN_DELETE)
+
+struct follow_file {
+  struct follow_file *next; // In the same bucket.
+  char *path;               // Where it was last seen.
+  dev_t dev;
+  ino_t ino;
+  int compressed; // Scanned once, when complete.
+  int scanned;
+  struct follow_pos pos;
+};
+
+struct follow_dir {
+  char *path;
+  int only_roots;  // Only watched for the root files in it.
+  size_t root_len; // Of the path of the root it is under.
+};
+
+int follow_init(struct follow *fw) {
+  memset(fw, 0, sizeof(struct follow));
+
+  fw->num_buckets = 256;
+  fw->buckets = calloc(fw->num_buckets, sizeof(struct follow_file *));
+  if (fw->buckets == NULL)
+    return -1;
+
+  fw->fd = inotify_init1(IN_CLOEXEC);
+  if (fw->fd < 0) {
+    free(fw->buckets);
+    return -1;
+  }
+  return 0;
+}
+
+static size_t bucket_of(const struct follow *fw, dev_t dev, ino_t ino) {
+  uint64_t h = ((uint64_t)dev * 31 + (uint64_t)ino) * 0x9e3779b97f4a7c15ULL;
+  return (size_t)(h >> 32) & (fw->num_buckets - 1);
+}
+
+static struct follow_file *lookup(struct follow *fw, dev_t dev, ino_t ino) {
+  struct follow_file *f = fw->buckets[bucket_of(fw, dev, ino)];
+  while (f != NULL && (f->dev != dev || f->ino != ino))
+    f = f->next;
+  return f;
+}
+
+// Double the number of buckets.  The entries themselves stay put, so
+// pointers to their positions remain valid.
+static void grow(struct follow *fw) {
+  size_t old = fw->num_buckets;
+  struct follow_file **old_buckets = fw->buckets;
+  struct follow_file **buckets = calloc(2 * old, sizeof(struct follow_file *));
+  if (buckets == NULL)
+    return; // Just slower.
+
+  fw->buckets = buckets;
+  fw->num_buckets = 2 * old;
+  for (size_t i = 0; i < old; i++) {
+    struct follow_file *f = old_buckets[i];
+    while (f != NULL) {
+      struct follow_file *next = f->next;
+      size_t b = bucket_of(fw, f->dev, f->ino);
+      f->next = buckets[b];
+      buckets[b] = f;
+      f = next;
+    }
+  }
+  free(old_buckets);
+}
+
+static struct follow_file *insert(struct follow *fw, const char *path,
+                                  const struct stat *st) {
+  struct follow_file *f = calloc(1, sizeof(struct follow_file));
+  if (f == NULL)
+    return NULL;
+  f->path = strdup(path);
+  if (f->path == NULL) {
+    free(f);
+    return NULL;
+  }
+  f->dev = st->st_dev;
+  f->ino = st->st_ino;
+  f->compressed = input_probe(path) != INPUT_PLAIN;
+  f->pos.lineno = 1;
+  f->pos.final = f->compressed;
+
+  if (fw->num_files >= 2 * fw->num_buckets)
+    grow(fw);
+  size_t b = bucket_of(fw, f->dev, f->ino);
+  f->next = fw->buckets[b];
+  fw->buckets[b] = f;
+  fw->num_files++;
+  return f;
+}
+
+// Drop the file last seen at 'path', which was deleted.  Its inode
+// number may be reused for a new file, which must start afresh.
+// Deletions are rare enough that a linear search will do.
+static void forget(struct follow *fw, const char *path) {
+  for (size_t i = 0; i < fw->num_buckets; i++) {
+    for (struct follow_file **fp = &fw->buckets[i]; *fp != NULL;
+         fp = &(*fp)->next) {
+      struct follow_file *f = *fp;
+      if (strcmp(f->path, path) == 0) {
+        *fp = f->next;
+        free(f->path);
+        free(f);
+        fw->num_files--;
+        return;
+      }
+    }
+  }
+}
+
+static int watch(struct follow *fw, const char *path, int only_roots,
+                 size_t root_len) {
+  // A root file given without a directory lives in the current one.
+  int wd = inotify_add_watch(fw->fd, *path ? path : ".", FOLLOW_EVENTS);
+  if (wd < 0)
+    return -1;
+
+  if (wd >= fw->num_dirs) {
+    int num = wd + 1 > 2 * fw->num_dirs ? wd + 1 : 2 * fw->num_dirs;
+    struct follow_dir **dirs =
+        realloc(fw->dirs, (size_t)num * sizeof(struct follow_dir *));
+    if (dirs == NULL)
+      return -1;
+    memset(dirs + fw->num_dirs, 0,
+           (size_t)(num - fw->num_dirs) * sizeof(struct follow_dir *));
+    fw->dirs = dirs;
+    fw->num_dirs = num;
+  }
+
+  char *copy = strdup(path);
+  if (copy == NULL)
+    return -1;
+
+  struct follow_dir *dir = fw->dirs[wd];
+  if (dir != NULL) {
+    // The same directory again, maybe under a new name after being
+    // moved; the latest name is the one that works.
+    free(dir->path);
+    dir->path = copy;
+    dir->only_roots &= only_roots;
+    if (!only_roots)
+      dir->root_len = root_len;
+    return 0;
+  }
+
+  dir = malloc(sizeof(struct follow_dir));
+  if (dir == NULL) {
+    free(copy);
+    return -1;
+  }
+  dir->path = copy;
+  dir->only_roots = only_roots;
+  dir->root_len = root_len;
+  fw->dirs[wd] = dir;
+  return 0;
+}
+
+int follow_add_dir(struct follow *fw, const char *path) {
+  return watch(fw, path, 0, fw->walk != NULL ? fw->walk->root_len : 0);
+}
+
+struct follow_pos *follow_add_file(struct follow *fw, const char *path,
+                                   const struct stat *st, int root) {
+  struct follow_file *f = lookup(fw, st->st_dev, st->st_ino);
+  if (f != NULL)
+    return NULL; // Already scanned under another name.
+
+  if (root) {
+    char **roots = realloc(fw->roots, (size_t)(fw->num_roots + 1) *
+                                          sizeof(char *));
+    if (roots == NULL)
+      return NULL;
+    fw->roots = roots;
+    if ((roots[fw->num_roots] = strdup(path)) == NULL)
+      return NULL;
+    fw->num_roots++;
+
+    // Watch its directory, for this name only.
+    char *dir = strdup(path);
+    if (dir == NULL)
+      return NULL;
+    char *slash = strrchr(dir, '/');
+    if (slash == NULL)
+      *dir = '\0';
+    else
+      slash[slash == dir] = '\0'; // Keep the '/' of "/name".
+    int rc = watch(fw, dir, 1, 0);
+    free(dir);
+    if (rc != 0)
+      return NULL;
+  }
+
+  f = insert(fw, path, st);
+  if (f == NULL)
+    return NULL;
+  f->scanned = 1;
+  return &f->pos;
+}
+
+static int is_root(const struct follow *fw, const char *path) {
+  for (int i = 0; i < fw->num_roots; i++) {
+    if (strcmp(fw->roots[i], path) == 0)
+      return 1;
+  }
+  return 0;
+}
+
+static char *join(const char *dir, const char *name) {
+  size_t len = strlen(dir);
+  char *path = malloc(len + strlen(name) + 2);
+  if (path != NULL) {
+    int slash = len > 0 && dir[len - 1] != '/';
+    sprintf(path, "%s%s%s", dir, slash ? "/" : "", name);
+  }
+  return path;
+}
+
+// The part of 'path', in a directory watched with 'only_roots' and
+// 'root_len', below the root it is under, for walk_wanted().  A root
+// file is its own root.
+static const char *below_root(const char *path, int only_roots,
+                              size_t root_len) {
+  if (only_roots) {
+    const char *name = strrchr(path, '/');
+    return name != NULL ? name + 1 : path;
+  }
+  return path + root_len + 1;
+}
+
+// Look at the regular file 'path' after 'mask' happened to it, and
+// scan whatever is new.  'rel' is as for walk_wanted().
+static int check(struct follow *fw, const char *path, const char *rel,
+                 const struct stat *st, uint32_t mask, follow_scan_fn scan,
+                 void *arg) {
+  struct follow_file *f = lookup(fw, st->st_dev, st->st_ino);
+  if (f == NULL) {
+    if (fw->walk != NULL && !walk_wanted(fw->walk, path, rel, st))
+      return 0;
+    f = insert(fw, path, st);
+    if (f == NULL)
+      return -1;
+  } else if (strcmp(f->path, path) != 0) {
+    // Renamed; the data seen so far stays seen.
+    char *copy = strdup(path);
+    if (copy != NULL) {
+      free(f->path);
+      f->path = copy;
+    }
+  }
+
+  if (f->compressed) {
+    // Compressed files are written whole, then read whole.
+    if (f->scanned || !(mask & (IN_CLOSE_WRITE | IN_MOVED_TO)))
+      return 0;
+    f->scanned = 1;
+    return scan(arg, f->path, &f->pos);
+  }
+
+  if (st->st_size < f->pos.offset) {
+    warnx("%s: file truncated", f->path);
+    memset(&f->pos, 0, sizeof(f->pos));
+    f->pos.lineno = 1;
+  }
+  if (st->st_size == f->pos.offset)
+    return 0;
+  f->scanned = 1;
+  return scan(arg, f->path, &f->pos);
+}
+
+// Watch the new directory 'path' and everything below it, and scan
+// the files in it.  It is under a root whose path is 'root_len' long.
+// What walk_wanted() leaves out is pruned, as the initial traversal
+// would have.
+static int walk(struct follow *fw, const char *path, size_t root_len,
+                follow_scan_fn scan, void *arg) {
+  char *paths[] = {(char *)path, NULL};
+  FTS *ftsp = fts_open(paths, FTS_LOGICAL | FTS_NOCHDIR, NULL);
+  if (ftsp == NULL)
+    return -1;
+
+  int rc = 0;
+  FTSENT *p;
+  while (rc == 0 && (p = fts_read(ftsp)) != NULL) {
+    const char *rel = p->fts_path + root_len + 1;
+    switch (p->fts_info) {
+    case FTS_D:
+      if (fw->walk != NULL &&
+          !walk_wanted(fw->walk, p->fts_path, rel, p->fts_statp)) {
+        fts_set(ftsp, p, FTS_SKIP);
+        break;
+      }
+      if (watch(fw, p->fts_path, 0, root_len) != 0)
+        warn("cannot watch %s", p->fts_path);
+      break;
+    case FTS_F:
+      rc = check(fw, p->fts_path, rel, p->fts_statp, IN_CLOSE_WRITE, scan,
+                 arg);
+      break;
+    default:
+      break;
+    }
+  }
+
+  fts_close(ftsp);
+  return rc;
+}
+
+// After events were lost, look at every watched directory again.
+static int recheck(struct follow *fw, follow_scan_fn scan, void *arg) {
+  // walk() may add directories, so do not hold on to 'fw->dirs'.
+  for (int wd = 0; wd < fw->num_dirs; wd++) {
+    if (fw->dirs[wd] == NULL)
+      continue;
+
+    char *dir = strdup(fw->dirs[wd]->path);
+    int only_roots = fw->dirs[wd]->only_roots;
+    size_t root_len = fw->dirs[wd]->root_len;
+    DIR *d = dir != NULL ? opendir(*dir ? dir : ".") : NULL;
+    struct dirent *e;
+    int rc = 0;
+
+    while (rc == 0 && d != NULL && (e = readdir(d)) != NULL) {
+      struct stat st;
+      char *path = join(dir, e->d_name);
+      if (path != NULL && (!only_roots || is_root(fw, path)) &&
+          stat(path, &st) == 0 && S_ISREG(st.st_mode))
+        rc = check(fw, path, below_root(path, only_roots, root_len), &st,
+                   IN_CLOSE_WRITE, scan, arg);
+      free(path);
+    }
+
+    if (d != NULL)
+      closedir(d);
+    free(dir);
+    if (rc != 0)
+      return rc;
+  }
+  return 0;
+}
+
+static int handle(struct follow *fw, const struct inotify_event *ev,
+                  follow_scan_fn scan, void *arg) {
+  if (ev->mask & IN_Q_OVERFLOW) {
+    warnx("too many changes at once, rechecking everything");
+    return recheck(fw, scan, arg);
+  }
+  if (ev->wd < 0 || ev->wd >= fw->num_dirs || fw->dirs[ev->wd] == NULL)
+    return 0;
+
+  struct follow_dir *dir = fw->dirs[ev->wd];
+  if (ev->mask & IN_IGNORED) {
+    // The directory is gone.
+    free(dir->path);
+    free(dir);
+    fw->dirs[ev->wd] = NULL;
+    return 0;
+  }
+  if (ev->len == 0)
+    return 0;
+
+  char *path = join(dir->path, ev->name);
+  if (path == NULL)
+    return -1;
+
+  int rc = 0;
+  struct stat st;
+  if (dir->only_roots && !is_root(fw, path)) {
+    // Some other file next to one we follow.
+  } else if (ev->mask & IN_DELETE) {
+    forget(fw, path);
+  } else if (ev->mask & IN_MOVED_FROM) {
+    // Moved away.  If it was moved within the tree, IN_MOVED_TO will
+    // find it again by its inode.
+  } else if (stat(path, &st) != 0) {
+    // Gone again already.
+  } else if (S_ISDIR(st.st_mode)) {
+    if (!dir->only_roots && (ev->mask & (IN_CREATE | IN_MOVED_TO)))
+      rc = walk(fw, path, dir->root_len, scan, arg);
+  } else if (S_ISREG(st.st_mode)) {
+    rc = check(fw, path, below_root(path, dir->only_roots, dir->root_len),
+               &st, ev->mask, scan, arg);
+  }
+
+  free(path);
+  return rc;
+}
+
+int follow_run(struct follow *fw, follow_scan_fn scan, void *arg) {
+  // Room for many events; each is followed by a name of at most
+  // NAME_MAX + 1 bytes.
+  char buf[64 * 1024]
+      __attribute__((aligned(__alignof__(struct inotify_event))));
+
+  for (;;) {
+    ssize_t n = read(fw->fd, buf, sizeof(buf));
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+
+    for (char *p = buf; p < buf + n;) {
+      const struct inotify_event *ev = (const struct inotify_event *)p;
+      p += sizeof(struct inotify_event) + ev->len;
+
+      int rc = handle(fw, ev, scan, arg);
+      if (rc != 0)
+        return rc > 0 ? 0 : -1;
+    }
+  }
+}
+
+void follow_destroy(struct follow *fw) {
+  close(fw->fd);
+
+  for (size_t i = 0; i < fw->num_buckets; i++) {
+    struct follow_file *f = fw->buckets[i];
+    while (f != NULL) {
+      struct follow_file *next = f->next;
+      free(f->path);
+      free(f);
+      f = next;
+    }
+  }
+  free(fw->buckets);
+
+  for (int wd = 0; wd < fw->num_dirs; wd++) {
+    if (fw->dirs[wd] != NULL) {
+      free(fw->dirs[wd]->path);
+      free(fw->dirs[wd]);
+    }
+  }
+  free(fw->dirs);
+
+  for (int i = 0; i < fw->num_roots; i++)
+    free(fw->roots[i]);
+  free(fw->roots);
+}
@@ -0,0 +1,83 @@
+#ifndef FOLLOW_H
+#define FOLLOW_H
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "walk.h"
+
+// --follow: after the initial scan, keep watching the traversed
+// directories with inotify, and scan only what is appended to known
+// files, plus files that appear later.  Files are recognised by
+// (device, inode), so a file that is renamed keeps its place, and a
+// new file created under an old name (log rotation) starts afresh.  A
+// file that shrinks is taken to have been truncated and is rescanned
+// from the start.
+//
+// Compressed files cannot be appended to, and are scanned once.
+
+// How far a file has been scanned.  The scanner advances it.
+struct follow_pos {
+  off_t offset; // Bytes already scanned (only complete lines, for grep).
+  int lineno;   // Number of the next line.
+  int matches;  // Matches found so far.
+  int binary;   // The file looked binary on its first scan.
+  int final;    // The file will not grow; a last line without newline
+                // is complete.
+};
+
+struct follow_file;
+struct follow_dir;
+
+struct follow {
+  int fd; // The inotify instance.
+
+  // Known files, hashed on (device, inode).
+  struct follow_file **buckets;
+  size_t num_buckets;
+  size_t num_files;
+
+  // Watched directories, indexed by watch descriptor.
+  struct follow_dir **dirs;
+  int num_dirs;
+
+  // Paths given as roots that are files rather than directories.
+  // Their directories are watched for these names only.
+  char **roots;
+  int num_roots;
+
+  // If set by the caller, files and directories that appear later are
+  // only scanned or walked if walk_wanted() agrees.
+  const struct walk *walk;
+};
+
+// Scan 'path' from 'pos' onwards.  Returning non-zero ends
+// follow_run().
+typedef int (*follow_scan_fn)(void *arg, const char *path,
+                              struct follow_pos *pos);
+
+// Returns non-zero on error, with errno set.
+int follow_init(struct follow *fw);
+
+// Watch the directory 'path', found by the initial traversal.  If
+// 'walk' is set, it must be the one walk_visit() is taking through
+// that traversal, for the root 'path' is under.  Returns non-zero on
+// error.
+int follow_add_dir(struct follow *fw, const char *path);
+
+// Register the file 'path', found by the initial traversal ('root' is
+// set if it was named on the command line).  Returns the position the
+// initial scan is to advance.  Returns NULL on error, or if the file
+// is known already under another name, and need not be scanned again.
+// The position stays valid until follow_destroy(), and may be written
+// by another thread while follow_add_file() is called again.
+struct follow_pos *follow_add_file(struct follow *fw, const char *path,
+                                   const struct stat *st, int root);
+
+// Wait for changes and scan them, until 'scan' returns non-zero or an
+// error occurs.  Returns 0 in the former case, -1 in the latter.
+int follow_run(struct follow *fw, follow_scan_fn scan, void *arg);
+
+void follow_destroy(struct follow *fw);
+
+#endif
@@ -0,0 +1,331 @@
+// Setting _GNU_SOURCE (which implies _DEFAULT_SOURCE) is necessary to
+// activate visibility of certain header file contents on GNU/Linux
+// systems, such as memmem().
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/types.h>
+
+// err.h contains various nonstandard BSD extensions, but they are
+// very handy.
+#include <err.h>
+
+#include "ere.h"
+#include "grep.h"
+#include "input.h"
+#include "search.h"
+#include "shard.h"
+
+int grep_parse(struct grep *g, int argc, char *const *argv,
+               int *num_threads) {
+  memset(g, 0, sizeof(struct grep));
+  g->binary = GREP_BINARY_REPORT;
+  walk_init(&g->walk);
+  if (num_threads != NULL) {
+    *num_threads = 1;
+  }
+
+  int i = 1;
+  for (; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++) {
+    if (strcmp(argv[i], "--") == 0) {
+      i++;
+      break;
+    }
+    if (strcmp(argv[i], "--follow") == 0) {
+      g->follow = 1;
+      continue;
+    }
+    if (strcmp(argv[i], "--io") == 0) {
+      if (++i >= argc || input_parse_io(argv[i], &g->io) != 0) {
+        g->error = "unknown I/O strategy (use " INPUT_IO_NAMES ")";
+        return -1;
+      }
+      continue;
+    }
+    if (strcmp(argv[i], "--shard") == 0) {
+      if (++i >= argc || shard_parse(argv[i], &g->shard) != 0) {
+        g->error = "invalid shard (use K/N, with 1 <= K <= N)";
+        return -1;
+      }
+      continue;
+    }
+    if (strcmp(argv[i], "--partial") == 0) {
+      if (++i >= argc) {
+        g->error = GREP_USAGE;
+        return -1;
+      }
+      g->partial = argv[i];
+      continue;
+    }
+    int taken = walk_parse(&g->walk, argc, argv, i, &g->error);
+    if (taken < 0)
+      return -1;
+    if (taken > 0) {
+      i += taken - 1;
+      continue;
+    }
+
+    // Flags may be bundled, as in '-Ei'.
+    for (const char *o = argv[i] + 1; *o != '\0'; o++) {
+      switch (*o) {
+      case 'n': {
+        // The count is either glued on ('-n4') or the next argument.
+        const char *arg = o[1] != '\0' ? o + 1 : NULL;
+        if (arg == NULL && ++i < argc)
+          arg = argv[i];
+        // Since atoi() simply returns zero on syntax errors, we cannot
+        // distinguish between the user entering a zero, or some
+        // non-numeric garbage.  A more robust solution would use
+        // strtol(), but its interface is more complicated, so here we
+        // are.
+        if (arg == NULL || atoi(arg) < 1) {
+          g->error = "invalid thread count";
+          return -1;
+        }
+        if (num_threads != NULL) {
+          *num_threads = atoi(arg);
+        }
+        goto next_arg;
+      }
+      case 'E':
+        g->use_regex = 1;
+        break;
+      case 'i':
+        g->icase = 1;
+        break;
+      case 'a':
+        g->binary = GREP_BINARY_TEXT;
+        break;
+      case 'I':
+        g->binary = GREP_BINARY_SKIP;
+        break;
+      case 'l':
+        g->list_files = 1;
+        break;
+      case 'q':
+        g->quiet = 1;
+        break;
+      case 'm': {
+        const char *arg = o[1] != '\0' ? o + 1 : NULL;
+        if (arg == NULL && ++i < argc)
+          arg = argv[i];
+        if (arg == NULL || atoi(arg) < 1) {
+          g->error = "invalid match count";
+          return -1;
+        }
+        g->max_count = atoi(arg);
+        goto next_arg;
+      }
+      default:
+        g->error = GREP_USAGE;
+        return -1;
+      }
+    }
+  next_arg:;
+  }
+
+  if (i >= argc) {
+    g->error = GREP_USAGE;
+    return -1;
+  }
+
+  g->needle = strdup(argv[i]);
+  if (g->needle == NULL) {
+    g->error = "out of memory";
+    return -1;
+  }
+  g->needle_len = strlen(g->needle);
+
+  // search_ci() wants the needle folded, once, up front.
+  if (g->icase && !g->use_regex) {
+    search_fold(g->needle, g->needle_len);
+  }
+
+  return i + 1;
+}
+
+// Checks a single line of 'len' bytes (including any newline)
+// against the search.  memmem() is used rather than strstr() so that
+// lines containing NUL bytes are searched in full.
+static int line_matches(const struct grep *g, const char *line, size_t len) {
+  if (g->re != NULL) {
+    // The regex sees the line without its newline, so '$' works.
+    if (len > 0 && line[len - 1] == '\n')
+      len--;
+    return ere_match(g->re, line, len);
+  }
+  if (g->icase) {
+    // Folds the line on the fly, 16 bytes at a time.
+    return search_ci(line, len, g->needle, g->needle_len) != NULL;
+  }
+  return memmem(line, len, g->needle, g->needle_len) != NULL;
+}
+
+// Report that 'path' could not be opened, seeked in or read.
+static void fail(const struct grep *g, const char *path, const char *what,
+                 void *arg) {
+  int errnum = errno;
+  if (g->fail != NULL)
+    g->fail(arg, path, what, errnum);
+  else
+    warnx("failed to %s %s: %s", what, path, strerror(errnum));
+}
+
+int grep_file(const struct grep *g, const char *path, void *arg) {
+  struct follow_pos pos = {0, 1, 0, 0, 1};
+  return grep_file_from(g, path, &pos, arg);
+}
+
+int grep_file_from(const struct grep *g, const char *path,
+                   struct follow_pos *pos, void *arg) {
+  if (pos->matches > 0 && (g->list_files || g->quiet || pos->binary ||
+                           pos->matches == g->max_count))
+    return 0;
+
+  FILE *file = input_open(path, g->io);
+
+  if (file == NULL) {
+    fail(g, path, "open", arg);
+    return -1;
+  }
+
+  if (pos->offset > 0) {
+    // Only plain files are continued (see follow.h), so this works.
+    if (fseeko(file, pos->offset, SEEK_SET) != 0) {
+      fail(g, path, "seek in", arg);
+      fclose(file);
+      return -1;
+    }
+  } else if (g->binary != GREP_BINARY_TEXT) {
+    // Only the first block is looked at, so multi-GB binaries cost
+    // one small read when skipped.
+    char block[SEARCH_SNIFF_BYTES];
+    size_t n = fread(block, 1, sizeof(block), file);
+    pos->binary = search_looks_binary(block, n);
+    rewind(file);
+  }
+  if (pos->binary && g->binary == GREP_BINARY_SKIP) {
+    fclose(file);
+    return 0;
+  }
+
+  char *line = NULL;
+  size_t linelen = 0;
+  ssize_t len;
+  int matched = 0;
+
+  while (!g->stop && (len = getline(&line, &linelen, file)) != -1) {
+    // A line still being written is left for next time.
+    if (!pos->final && line[len - 1] != '\n')
+      break;
+    pos->offset += len;
+    int lineno = pos->lineno++;
+
+    if (line_matches(g, line, (size_t)len)) {
+      matched = 1;
+      pos->matches++;
+
+      // The first match settles -q and -l, so the rest of the file is
+      // never read.
+      if (g->quiet)
+        break;
+      struct grep_match m = {path, lineno, line, (size_t)len, pos->binary,
+                             g->list_files};
+      g->emit(arg, &m);
+
+      // One line of output per binary file is all we promise.
+      if (pos->binary || g->list_files || pos->matches == g->max_count)
+        break;
+    }
+  }
+
+  // A compressed file can turn out to be corrupt halfway through.
+  if (ferror(file))
+    fail(g, path, "read", arg);
+
+  // Cleanup of allocated ressources.
+  free(line);
+  fclose(file);
+  return matched;
+}
+
+void grep_print(FILE *out, const struct grep_match *m) {
+  if (m->name_only) {
+    fprintf(out, "%s\n", m->path);
+  } else if (m->binary) {
+    fprintf(out, "Binary file %s matches\n", m->path);
+  } else {
+    // fwrite() rather than "%s", so NUL bytes under -a do not cut the
+    // line short.
+    fprintf(out, "%s:%d:", m->path, m->lineno);
+    fwrite(m->line, 1, m->len, out);
+  }
+}
+
+int grep_status(int how) {
+  if ((how & GREP_QUIET) && (how & GREP_MATCHED))
+    return 0;
+  if (how & GREP_FAILED)
+    return 2;
+  if (how & GREP_QUIET)
+    return 1;
+  return 0;
+}
+
+// Record tags.
+#define GREP_END 0
+#define GREP_MATCH 1
+
+void grep_save(FILE *f, uint64_t order, const struct grep_match *m) {
+  shard_put(f, GREP_MATCH);
+  shard_put(f, order);
+  shard_put(f, (uint64_t)m->lineno);
+  shard_put(f, (uint64_t)(m->binary ? 1 : 0) | (m->name_only ? 2 : 0));
+  shard_put_bytes(f, m->path, strlen(m->path));
+  shard_put_bytes(f, m->line, m->len);
+}
+
+void grep_save_end(FILE *f, int how) {
+  shard_put(f, GREP_END);
+  shard_put(f, (uint64_t)how);
+}
+
+int grep_load(FILE *f, struct grep_saved *s, int *how) {
+  uint64_t tag, lineno, flags;
+  if (shard_get(f, &tag) != 0)
+    return -1;
+  if (tag == GREP_END) {
+    if (shard_get(f, &flags) != 0 ||
+        (flags & ~(uint64_t)(GREP_QUIET | GREP_MATCHED | GREP_FAILED)))
+      return -1;
+    *how = (int)flags;
+    return 0;
+  }
+
+  char *path, *line;
+  size_t len;
+  if (tag != GREP_MATCH || shard_get(f, &s->order) != 0 ||
+      shard_get(f, &lineno) != 0 || lineno > INT32_MAX ||
+      shard_get(f, &flags) != 0 || shard_get_bytes(f, &path, &len) != 0)
+    return -1;
+  if (shard_get_bytes(f, &line, &s->m.len) != 0) {
+    free(path);
+    return -1;
+  }
+  s->m.path = path;
+  s->m.lineno = (int)lineno;
+  s->m.line = line;
+  s->m.binary = (flags & 1) != 0;
+  s->m.name_only = (flags & 2) != 0;
+  return 1;
+}
+
+void grep_free(struct grep *g) {
+  free(g->needle);
+  g->needle = NULL;
+  walk_free(&g->walk);
+}
@@ -0,0 +1,142 @@
+#ifndef GREP_H
+#define GREP_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "ere.h"
+#include "follow.h"
+#include "input.h"
+#include "shard.h"
+#include "walk.h"
+
+// The line-matching core of fauxgrep-mt, shared with scan-daemon.
+// Output goes through a callback, so that the caller decides where
+// (and under which lock) matches are written.
+
+#define GREP_USAGE                                                       \
+  "usage: [-n INT] [-E] [-i] [-a | -I] [-l | -q] [-m NUM] [--follow] "   \
+  "[--io " INPUT_IO_NAMES "] " WALK_USAGE " " SHARD_USAGE             \
+  " STRING paths..."
+
+// What to do with files that look binary (see search_looks_binary()).
+enum grep_binary {
+  GREP_BINARY_REPORT, // default: print "Binary file ... matches" once
+  GREP_BINARY_SKIP,   // -I: do not search them at all
+  GREP_BINARY_TEXT    // -a: search them like any other file
+};
+
+// A single match, as handed to the 'emit' callback.  The pointers are
+// only valid for the duration of the call.
+struct grep_match {
+  const char *path;
+  int lineno;
+  const char *line; // Including the newline, if any.
+  size_t len;
+  int binary;       // Set for the "Binary file ... matches" report.
+  int name_only;    // -l: just the path is to be shown.
+};
+
+struct grep {
+  // The needle, owned by the struct.  Folded to lower case if 'icase'
+  // is set and 'use_regex' is not.
+  char *needle;
+  size_t needle_len;
+  int use_regex; // -E
+  int icase;     // -i
+  enum grep_binary binary;
+  int list_files; // -l: report each matching file once, by name
+  int max_count;  // -m: stop each file after this many matches (0: never)
+  int quiet;      // -q: report nothing; see grep_file()'s return value
+  int follow;     // --follow: keep scanning what is appended to files
+  enum input_io io; // --io: how files are read
+  struct walk walk; // Which files to search (see walk.h).
+  struct shard shard;  // --shard: which of them are ours (see shard.h).
+  const char *partial; // --partial: where to save matches, or NULL.
+
+  // Checked between lines; setting it makes every grep_file() in
+  // progress return early.  Used to stop once -q has its answer.
+  // Atomic, as it is set by one worker while others read it.
+  atomic_int stop;
+
+  // Compiled form of 'needle' when 'use_regex' is set.  Not filled in
+  // by grep_parse(); the caller compiles (or looks up) the regex, so
+  // that it can be shared.
+  struct ere *re;
+
+  // Called for every match, with the 'arg' given to grep_file().  May
+  // be called concurrently from several threads searching different
+  // files.
+  void (*emit)(void *arg, const struct grep_match *m);
+
+  // Called, with the same 'arg', when a file cannot be opened or read:
+  // 'what' is "open", "seek in" or "read", and 'errnum' says why.  If
+  // NULL, a warning goes to stderr.
+  void (*fail)(void *arg, const char *path, const char *what, int errnum);
+
+  // Set by grep_parse() on failure.
+  const char *error;
+};
+
+// Parse a fauxgrep-mt command line ('argv[0]' is the program name).
+// If 'num_threads' is non-NULL, it receives the argument of -n (or 1
+// if there is none).  Does not use getopt(), so it is safe to call
+// from several threads at once.  Returns the index in 'argv' of the
+// first path, or -1 on error, in which case 'g->error' says why.
+int grep_parse(struct grep *g, int argc, char *const *argv, int *num_threads);
+
+// Search the file at 'path', calling 'g->emit(arg, ...)' for every
+// match.  With -l, -q or -m, stops reading the file as soon as there
+// is nothing more to report.  Returns 1 if anything matched, 0 if
+// not, and -1 if the file could not be opened.  Errors are also
+// passed to 'g->fail'.
+int grep_file(const struct grep *g, const char *path, void *arg);
+
+// Like grep_file(), but continue from where 'pos' says an earlier call
+// left off, and advance it.  Unless 'pos->final' is set, a last line
+// without a newline is left for the next call, as it may still be
+// being written.  A file that has reported all it will (under -l, -q,
+// -m, or as a binary file) is not read again.
+int grep_file_from(const struct grep *g, const char *path,
+                   struct follow_pos *pos, void *arg);
+
+// Write a match to 'out' in the usual "path:lineno:line" format.
+void grep_print(FILE *out, const struct grep_match *m);
+
+// How a run went, for its exit status.
+#define GREP_QUIET 1   // -q was given.
+#define GREP_MATCHED 2 // Some file matched.
+#define GREP_FAILED 4  // Some file could not be opened or read.
+
+// The exit status of a run that went as 'how' (GREP_* or'ed together).
+// Like grep: 2 after an error, unless -q found a match anyway, and
+// otherwise under -q, 0 if anything matched and 1 if not.
+int grep_status(int how);
+
+// A partial result (see shard.h) holds the matches, each with the
+// position of its file in the traversal to put them in order, and then
+// an end record with how the run went.
+
+// Save a match found in the 'order'th file.
+void grep_save(FILE *f, uint64_t order, const struct grep_match *m);
+
+// Save the end record.
+void grep_save_end(FILE *f, int how);
+
+// A match read back by grep_load().  Its path and line are malloc()ed.
+struct grep_saved {
+  uint64_t order;
+  struct grep_match m;
+};
+
+// Read the next record of a partial result.  Returns 1 for a match, 0
+// for the end record, which sets '*how', and -1 if the file is cut
+// short or corrupt.
+int grep_load(FILE *f, struct grep_saved *s, int *how);
+
+// Free the resources held by 'g' (but not 'g->re').  Also to be called
+// after grep_parse() fails.
+void grep_free(struct grep *g);
+
+#endif
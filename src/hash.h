@@ -0,0 +1,53 @@
+// This header file contains not just function prototypes, but also
+// the definitions.  This means it does not need to be compiled
+// separately.  It is shared by stats.c (-s hash) and dedup.c
+// (--dedup-content), which must hash file contents the same way.
+
+#ifndef HASH_H
+#define HASH_H
+
+#include <stdint.h>
+#include <string.h>
+
+// The hash is a single lane of MurmurHash3's x64 mixing, fed 8 bytes
+// at a time.  It is not cryptographic; it only has to tell different
+// inputs apart, and keep up with the byte counting.  A file is hashed
+// by starting from 0, passing every word to hash_word() (the last one
+// padded with zeros), and finishing with hash_end().
+#define HASH_C1 0x87c37b91114253d5ULL
+#define HASH_C2 0x4cf5ad432745937fULL
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t fmix64(uint64_t k) {
+  k ^= k >> 33;
+  k *= 0xff51afd7ed558ccdULL;
+  k ^= k >> 33;
+  k *= 0xc4ceb9fe1a85ec53ULL;
+  k ^= k >> 33;
+  return k;
+}
+
+static inline uint64_t load64(const unsigned char *p) {
+  uint64_t w;
+  memcpy(&w, p, sizeof(w));
+  return w;
+}
+
+static inline uint64_t hash_word(uint64_t h, uint64_t k) {
+  k *= HASH_C1;
+  k = rotl64(k, 31);
+  k *= HASH_C2;
+  h ^= k;
+  h = rotl64(h, 27);
+  return h * 5 + 0x52dce729;
+}
+
+// The length tells "ab" from "ab\0", which pad to the same word.
+static inline uint64_t hash_end(uint64_t h, uint64_t len) {
+  return fmix64(h ^ len);
+}
+
+#endif
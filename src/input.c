@@ -0,0 +1,618 @@
+// Setting _GNU_SOURCE is necessary to activate visibility of certain
+// header file contents on GNU/Linux systems, such as fopencookie().
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "input.h"
+
+// Compressed bytes read at a time.
+#define INPUT_BUFSIZE 65536
+
+// Plain bytes read at a time, other than through stdio.
+#define INPUT_READ_BYTES (1 << 20)
+
+// O_DIRECT wants buffers, offsets and lengths aligned to the logical
+// block size of the device, which is at most a page in practice.
+#define INPUT_ALIGN 4096
+
+// How far ahead readahead is asked for, and how much is read before
+// it is dropped from the page cache.
+#define INPUT_WINDOW (8 << 20)
+
+// Aligned buffers kept for reuse by the next O_DIRECT stream.
+#define INPUT_POOL_SIZE 64
+
+// A decompressing stream (or, with --io, a plain one), as seen by the
+// fopencookie() callbacks.
+struct cookie {
+  int fd;
+  enum input_format format;
+  enum input_io io;
+  off_t start;    // Where the compressed data begins,
+  off_t length;   // and how much of it there is (-1: up to EOF).
+  off_t consumed; // Compressed bytes read so far.
+  int eof;        // Nothing more to read from 'fd'.
+  int mid_member; // The decoder is inside a member; EOF here is an error.
+  off_t advised;  // Readahead has been asked for up to here,
+  off_t dropped;  // and the cached pages before here dropped.
+  unsigned char *block; // O_DIRECT: an aligned buffer from the pool,
+  size_t block_len;     // holding this many bytes read at
+  size_t block_pos;     // 'consumed - block_len', this many handed out.
+  z_stream zs;
+#ifdef HAVE_ZSTD
+  ZSTD_DStream *zds;
+  ZSTD_inBuffer zin;
+#endif
+  unsigned char in[INPUT_BUFSIZE];
+};
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static void *pool[INPUT_POOL_SIZE];
+static int pool_len;
+
+static void *pool_get(void) {
+  void *buf = NULL;
+
+  pthread_mutex_lock(&pool_lock);
+  if (pool_len > 0)
+    buf = pool[--pool_len];
+  pthread_mutex_unlock(&pool_lock);
+
+  if (buf == NULL && posix_memalign(&buf, INPUT_ALIGN, INPUT_READ_BYTES) != 0)
+    return NULL;
+  return buf;
+}
+
+static void pool_put(void *buf) {
+  if (buf == NULL)
+    return;
+
+  pthread_mutex_lock(&pool_lock);
+  if (pool_len < INPUT_POOL_SIZE) {
+    pool[pool_len++] = buf;
+    buf = NULL;
+  }
+  pthread_mutex_unlock(&pool_lock);
+  free(buf);
+}
+
+int input_parse_io(const char *name, enum input_io *io) {
+  if (strcmp(name, "stdio") == 0)
+    *io = INPUT_IO_STDIO;
+  else if (strcmp(name, "fadvise") == 0)
+    *io = INPUT_IO_FADVISE;
+  else if (strcmp(name, "direct") == 0)
+    *io = INPUT_IO_DIRECT;
+  else
+    return 1;
+  return 0;
+}
+
+enum input_format input_detect(const unsigned char *buf, size_t len) {
+  if (len >= 2 && buf[0] == 0x1f && buf[1] == 0x8b)
+    return INPUT_GZIP;
+  if (len >= 4 && buf[0] == 0x28 && buf[1] == 0xb5 && buf[2] == 0x2f &&
+      buf[3] == 0xfd)
+    return INPUT_ZSTD;
+  return INPUT_PLAIN;
+}
+
+// Called as reading reaches 'c->consumed': keep readahead a window in
+// front, and drop what has been read from the page cache, a window at
+// a time.  The kernel only counts this as advice, so errors are of no
+// consequence.
+static void advise(struct cookie *c) {
+  off_t pos = c->start + c->consumed;
+
+  if (c->io != INPUT_IO_FADVISE)
+    return;
+  if (pos + INPUT_WINDOW / 2 >= c->advised) {
+    if (c->advised < pos)
+      c->advised = pos;
+    posix_fadvise(c->fd, c->advised, INPUT_WINDOW, POSIX_FADV_WILLNEED);
+    c->advised += INPUT_WINDOW;
+  }
+  if (pos - c->dropped >= INPUT_WINDOW) {
+    posix_fadvise(c->fd, c->dropped, pos - c->dropped, POSIX_FADV_DONTNEED);
+    c->dropped = pos;
+  }
+}
+
+// Read the next compressed bytes into 'c->in'.  Returns how many, or
+// -1 on error.
+static ssize_t fill(struct cookie *c) {
+  size_t want = sizeof(c->in);
+  if (c->length >= 0 && (off_t)want > c->length - c->consumed)
+    want = (size_t)(c->length - c->consumed);
+
+  ssize_t n = 0;
+  if (want > 0) {
+    do {
+      n = pread(c->fd, c->in, want, c->start + c->consumed);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0)
+      return -1;
+  }
+
+  c->consumed += n;
+  if (n == 0)
+    c->eof = 1;
+  advise(c);
+  return n;
+}
+
+// Plain data under INPUT_IO_FADVISE, or a range of a plain file: stdio
+// asks for INPUT_READ_BYTES at a time, straight from the file.
+static ssize_t plain_read(struct cookie *c, char *buf, size_t size) {
+  // A range of a plain file ends where it says.
+  if (c->length >= 0 && (off_t)size > c->length - c->consumed)
+    size = (size_t)(c->length - c->consumed);
+  if (size == 0)
+    return 0;
+
+  ssize_t n;
+  do {
+    n = pread(c->fd, buf, size, c->start + c->consumed);
+  } while (n < 0 && errno == EINTR);
+
+  if (n > 0) {
+    c->consumed += n;
+    advise(c);
+  }
+  return n;
+}
+
+// Plain data under INPUT_IO_DIRECT: whole aligned blocks are read into
+// 'c->block', and handed out from there.
+static ssize_t direct_read(struct cookie *c, char *buf, size_t size) {
+  while (c->block_pos >= c->block_len) {
+    // Only the last block of the file is short, so 'consumed' stays
+    // aligned until there is nothing left to read.
+    if (c->eof)
+      return 0;
+    if (c->block_len > 0) {
+      c->block_pos = 0;
+      c->block_len = 0;
+    }
+
+    ssize_t n;
+    do {
+      n = pread(c->fd, c->block, INPUT_READ_BYTES, c->consumed);
+    } while (n < 0 && errno == EINTR);
+
+    if (n < 0 && errno == EINVAL) {
+      // The file system took O_DIRECT, but will not do the reads: go
+      // through the page cache after all.
+      int flags = fcntl(c->fd, F_GETFL);
+      if (flags < 0 || fcntl(c->fd, F_SETFL, flags & ~O_DIRECT) < 0)
+        return -1;
+      c->consumed += (off_t)c->block_pos;
+      pool_put(c->block);
+      c->block = NULL;
+      c->block_pos = 0;
+      c->io = INPUT_IO_FADVISE;
+      return plain_read(c, buf, size);
+    }
+    if (n < 0)
+      return -1;
+
+    // After a seek, 'block_pos' may already point into the block.
+    c->block_len = (size_t)n;
+    c->consumed += n;
+    if (n < INPUT_READ_BYTES)
+      c->eof = 1;
+  }
+
+  size_t n = c->block_len - c->block_pos;
+  if (n > size)
+    n = size;
+  memcpy(buf, c->block + c->block_pos, n);
+  c->block_pos += n;
+  return (ssize_t)n;
+}
+
+static ssize_t gzip_read(struct cookie *c, char *buf, size_t size) {
+  c->zs.next_out = (Bytef *)buf;
+  c->zs.avail_out = (uInt)size;
+
+  while (c->zs.avail_out == size) {
+    if (c->zs.avail_in == 0 && !c->eof) {
+      ssize_t n = fill(c);
+      if (n < 0)
+        return -1;
+      c->zs.next_in = c->in;
+      c->zs.avail_in = (uInt)n;
+    }
+    if (c->zs.avail_in == 0 && c->eof && !c->mid_member)
+      return 0;
+
+    int rc = inflate(&c->zs, Z_NO_FLUSH);
+    if (rc == Z_STREAM_END) {
+      // Concatenated members (from bgzip, or 'cat a.gz b.gz') make up
+      // a single stream, as with gzip -d.
+      inflateReset(&c->zs);
+      c->mid_member = 0;
+    } else if (rc == Z_OK) {
+      c->mid_member = 1;
+    } else if (rc != Z_BUF_ERROR || c->eof) {
+      // Corrupt, or cut short.
+      errno = EIO;
+      return -1;
+    }
+  }
+
+  return (ssize_t)(size - c->zs.avail_out);
+}
+
+#ifdef HAVE_ZSTD
+static ssize_t zstd_read(struct cookie *c, char *buf, size_t size) {
+  ZSTD_outBuffer out = {buf, size, 0};
+
+  while (out.pos == 0) {
+    if (c->zin.pos == c->zin.size && !c->eof) {
+      ssize_t n = fill(c);
+      if (n < 0)
+        return -1;
+      c->zin.src = c->in;
+      c->zin.size = (size_t)n;
+      c->zin.pos = 0;
+    }
+    if (c->zin.pos == c->zin.size && c->eof && !c->mid_member)
+      return 0;
+
+    // Consecutive frames are decoded one after the other.
+    size_t rc = ZSTD_decompressStream(c->zds, &out, &c->zin);
+    if (ZSTD_isError(rc)) {
+      errno = EIO;
+      return -1;
+    }
+    c->mid_member = rc != 0;
+
+    if (out.pos == 0 && c->zin.pos == c->zin.size && c->eof &&
+        c->mid_member) {
+      // Cut short in the middle of a frame.
+      errno = EIO;
+      return -1;
+    }
+  }
+
+  return (ssize_t)out.pos;
+}
+#endif
+
+static ssize_t cookie_read(void *cookie, char *buf, size_t size) {
+  struct cookie *c = cookie;
+
+  // zlib counts in uInt.
+  if (size > (1u << 30))
+    size = 1u << 30;
+
+  if (c->format == INPUT_PLAIN)
+    return c->block != NULL ? direct_read(c, buf, size)
+                            : plain_read(c, buf, size);
+#ifdef HAVE_ZSTD
+  if (c->format == INPUT_ZSTD)
+    return zstd_read(c, buf, size);
+#endif
+  return gzip_read(c, buf, size);
+}
+
+// Plain data can be read from anywhere.
+static int plain_seek(struct cookie *c, off64_t *offset, int whence) {
+  off_t pos = c->consumed - (off_t)(c->block_len - c->block_pos);
+
+  if (whence == SEEK_CUR)
+    *offset += pos;
+  if (*offset < 0 || whence == SEEK_END) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (c->block == NULL) {
+    c->consumed = *offset;
+    return 0;
+  }
+  if (*offset >= c->consumed - (off_t)c->block_len &&
+      *offset <= c->consumed) {
+    // Still in the block at hand, as after sniffing the first bytes.
+    c->block_pos = (size_t)(*offset - (c->consumed - (off_t)c->block_len));
+    return 0;
+  }
+  c->consumed = *offset & ~(off_t)(INPUT_ALIGN - 1);
+  c->block_len = 0;
+  c->block_pos = (size_t)(*offset - c->consumed);
+  c->eof = 0;
+  return 0;
+}
+
+// Compressed data can only be rewound, by starting over.
+static int cookie_seek(void *cookie, off64_t *offset, int whence) {
+  struct cookie *c = cookie;
+
+  if (c->format == INPUT_PLAIN)
+    return plain_seek(c, offset, whence);
+  if (*offset != 0 || whence != SEEK_SET) {
+    errno = ESPIPE;
+    return -1;
+  }
+
+  c->consumed = 0;
+  c->eof = 0;
+  c->mid_member = 0;
+  inflateReset(&c->zs);
+  c->zs.avail_in = 0;
+#ifdef HAVE_ZSTD
+  ZSTD_initDStream(c->zds);
+  c->zin.pos = c->zin.size = 0;
+#endif
+  return 0;
+}
+
+static int cookie_close(void *cookie) {
+  struct cookie *c = cookie;
+
+  // The rest of what was read goes, too.
+  if (c->io == INPUT_IO_FADVISE && c->start + c->consumed > c->dropped)
+    posix_fadvise(c->fd, c->dropped, c->start + c->consumed - c->dropped,
+                  POSIX_FADV_DONTNEED);
+  pool_put(c->block);
+  inflateEnd(&c->zs);
+#ifdef HAVE_ZSTD
+  ZSTD_freeDStream(c->zds);
+#endif
+  int rc = close(c->fd);
+  free(c);
+  return rc;
+}
+
+// Wrap 'fd' in a stream decompressing 'length' bytes from 'start', or
+// reading them as they are for INPUT_PLAIN.  Takes ownership of 'fd',
+// even on failure.
+static FILE *open_cookie(int fd, enum input_format format, enum input_io io,
+                         off_t start, off_t length) {
+#ifndef HAVE_ZSTD
+  if (format == INPUT_ZSTD) {
+    close(fd);
+    errno = ENOTSUP;
+    return NULL;
+  }
+#endif
+
+  struct cookie *c = calloc(1, sizeof(struct cookie));
+  if (c == NULL) {
+    close(fd);
+    return NULL;
+  }
+  c->fd = fd;
+  c->format = format;
+  c->io = io;
+  c->start = start;
+  c->length = length;
+  c->advised = start;
+  c->dropped = start;
+
+  if (io == INPUT_IO_DIRECT) {
+    c->block = pool_get();
+    if (c->block == NULL) {
+      close(fd);
+      free(c);
+      errno = ENOMEM;
+      return NULL;
+    }
+  }
+  if (io != INPUT_IO_STDIO)
+    posix_fadvise(fd, start, length >= 0 ? length : 0,
+                  POSIX_FADV_SEQUENTIAL);
+
+  // 16 + MAX_WBITS: expect a gzip header and trailer.
+  if (inflateInit2(&c->zs, 16 + MAX_WBITS) != Z_OK) {
+    pool_put(c->block);
+    close(fd);
+    free(c);
+    errno = ENOMEM;
+    return NULL;
+  }
+#ifdef HAVE_ZSTD
+  c->zds = ZSTD_createDStream();
+  if (c->zds == NULL) {
+    inflateEnd(&c->zs);
+    pool_put(c->block);
+    close(fd);
+    free(c);
+    errno = ENOMEM;
+    return NULL;
+  }
+  ZSTD_initDStream(c->zds);
+#endif
+
+  cookie_io_functions_t fns = {cookie_read, NULL, cookie_seek, cookie_close};
+  FILE *f = fopencookie(c, "r", fns);
+  if (f == NULL) {
+    cookie_close(c);
+    return NULL;
+  }
+
+  // stdio would otherwise read plain data a few KiB at a time.
+  if (format == INPUT_PLAIN && io == INPUT_IO_FADVISE)
+    setvbuf(f, NULL, _IOFBF, INPUT_READ_BYTES);
+  return f;
+}
+
+static enum input_format sniff(int fd, off_t offset) {
+  unsigned char magic[4];
+  ssize_t n = pread(fd, magic, sizeof(magic), offset);
+  return n > 0 ? input_detect(magic, (size_t)n) : INPUT_PLAIN;
+}
+
+enum input_format input_probe(const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return INPUT_PLAIN;
+
+  enum input_format format = sniff(fd, 0);
+  close(fd);
+  return format;
+}
+
+FILE *input_open(const char *path, enum input_io io) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+
+  enum input_format format = sniff(fd, 0);
+  if (format != INPUT_PLAIN)
+    return open_cookie(fd, format, io == INPUT_IO_DIRECT ? INPUT_IO_FADVISE
+                                                         : io, 0, -1);
+
+  if (io == INPUT_IO_DIRECT) {
+    // Some file systems (tmpfs, for one) refuse O_DIRECT.
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_DIRECT) < 0)
+      io = INPUT_IO_FADVISE;
+  }
+  if (io != INPUT_IO_STDIO)
+    return open_cookie(fd, format, io, 0, -1);
+
+  FILE *f = fdopen(fd, "r");
+  if (f == NULL)
+    close(fd);
+  return f;
+}
+
+FILE *input_open_range(const char *path, const struct input_range *range,
+                       enum input_io io) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+  return open_cookie(fd, range->format, io == INPUT_IO_DIRECT ?
+                     INPUT_IO_FADVISE : io, range->offset, range->length);
+}
+
+// Ranges under construction by input_split().
+struct split {
+  struct input_range *ranges;
+  int num;
+  int cap;
+  enum input_format format;
+  off_t chunk;
+};
+
+// Account for the member of 'len' bytes at 'offset', starting a new
+// range if the current one is big enough already.
+static int add_member(struct split *sp, off_t offset, off_t len) {
+  struct input_range *last = sp->num > 0 ? &sp->ranges[sp->num - 1] : NULL;
+
+  if (last != NULL && last->length < sp->chunk) {
+    last->length += len;
+    return 0;
+  }
+
+  if (sp->num == sp->cap) {
+    int cap = sp->cap ? 2 * sp->cap : 16;
+    struct input_range *bigger =
+        realloc(sp->ranges, (size_t)cap * sizeof(struct input_range));
+    if (bigger == NULL)
+      return -1;
+    sp->ranges = bigger;
+    sp->cap = cap;
+  }
+  sp->ranges[sp->num++] = (struct input_range){sp->format, offset, len};
+  return 0;
+}
+
+// BGZF puts the compressed size of each member in a 'BC' extra field
+// of its gzip header, so members are found without inflating them.
+static int split_bgzf(struct split *sp, int fd, off_t size) {
+  off_t offset = 0;
+
+  while (offset < size) {
+    unsigned char h[18];
+    if (pread(fd, h, sizeof(h), offset) != (ssize_t)sizeof(h))
+      return -1;
+
+    // Magic, deflate, FEXTRA set, a 'BC' subfield of two bytes.
+    int xlen = h[10] | (h[11] << 8);
+    if (h[0] != 0x1f || h[1] != 0x8b || h[2] != 8 || !(h[3] & 4) ||
+        xlen < 6 || h[12] != 'B' || h[13] != 'C' || h[14] != 2 || h[15] != 0)
+      return -1;
+
+    off_t bsize = (h[16] | (h[17] << 8)) + 1;
+    if (add_member(sp, offset, bsize) != 0)
+      return -1;
+    offset += bsize;
+  }
+  return offset == size ? 0 : -1;
+}
+
+#ifdef HAVE_ZSTD
+// Every zstd frame says how long its blocks are, which is enough to
+// find where the next one starts.
+static int split_zstd(struct split *sp, int fd, off_t size) {
+  unsigned char *map = mmap(NULL, (size_t)size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED)
+    return -1;
+
+  int rc = 0;
+  off_t offset = 0;
+  while (rc == 0 && offset < size) {
+    size_t len = ZSTD_findFrameCompressedSize(map + offset,
+                                              (size_t)(size - offset));
+    if (ZSTD_isError(len) || len == 0)
+      rc = -1;
+    else
+      rc = add_member(sp, offset, (off_t)len);
+    offset += (off_t)len;
+  }
+
+  munmap(map, (size_t)size);
+  return rc;
+}
+#endif
+
+int input_split(const char *path, off_t chunk, struct input_range **ranges) {
+  *ranges = NULL;
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return -1;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return -1;
+  }
+
+  struct split sp = {NULL, 0, 0, sniff(fd, 0), chunk};
+  int rc = -1;
+  if (sp.format == INPUT_GZIP)
+    rc = split_bgzf(&sp, fd, st.st_size);
+#ifdef HAVE_ZSTD
+  if (sp.format == INPUT_ZSTD)
+    rc = split_zstd(&sp, fd, st.st_size);
+#endif
+  close(fd);
+
+  // Not splittable (or not worth it): read it in one go.
+  if (rc != 0 || sp.num < 2) {
+    free(sp.ranges);
+    return 0;
+  }
+  *ranges = sp.ranges;
+  return sp.num;
+}
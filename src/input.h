@@ -0,0 +1,73 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stdio.h>
+#include <sys/types.h>
+
+// Transparent decompression of the files we scan.  gzip (and, when
+// built with libzstd, zstd) inputs are recognised by their magic bytes
+// and read through a stdio stream that yields the decompressed bytes,
+// so callers can keep using fread() and getline().
+//
+// Compressed files made of many independent members (BGZF blocks as
+// written by bgzip, or multi-frame zstd) can also be split into ranges
+// that are decompressed separately, by different workers.
+
+enum input_format {
+  INPUT_PLAIN,
+  INPUT_GZIP,
+  INPUT_ZSTD
+};
+
+// A run of whole members of a compressed file, 'length' bytes of
+// compressed data starting at 'offset'.  For a plain file, just those
+// bytes.
+struct input_range {
+  enum input_format format;
+  off_t offset;
+  off_t length;
+};
+
+// How the bytes of plain files are read (--io).  Whole-tree scans read
+// every file once, and through the page cache they evict what other
+// programs on the machine keep hot in it.
+enum input_io {
+  INPUT_IO_STDIO,   // Through stdio, leaving the page cache to itself.
+  INPUT_IO_FADVISE, // In large reads, with readahead asked for, and
+                    // the pages dropped from the cache once read.
+  INPUT_IO_DIRECT   // With O_DIRECT into aligned buffers, bypassing the
+                    // cache, where the file system allows it (and as
+                    // INPUT_IO_FADVISE where not).
+};
+
+#define INPUT_IO_NAMES "stdio|fadvise|direct"
+
+// Parse the name of an I/O strategy.  Returns non-zero if unknown.
+int input_parse_io(const char *name, enum input_io *io);
+
+// Recognise a format by the first 'len' bytes of a file.
+enum input_format input_detect(const unsigned char *buf, size_t len);
+
+// Recognise the format of the file at 'path'.  Returns INPUT_PLAIN
+// if it cannot be read.
+enum input_format input_probe(const char *path);
+
+// Open 'path' for reading its contents, decompressed if need be, the
+// way 'io' says.  Compressed streams can be rewound, but not otherwise
+// seeked, and are never read with O_DIRECT.  Returns NULL and sets
+// errno on failure; ENOTSUP means a format we were not built to decode.
+FILE *input_open(const char *path, enum input_io io);
+
+// Like input_open(), but reads just the members (or bytes) in 'range'.
+FILE *input_open_range(const char *path, const struct input_range *range,
+                       enum input_io io);
+
+// Split the compressed file at 'path' into ranges of about 'chunk'
+// compressed bytes each, always at member boundaries.  Returns the
+// number of ranges, and the ranges themselves (to be freed by the
+// caller) in '*ranges'.  Returns 0 if the file cannot be split, being
+// plain, an ordinary single-stream gzip, or too small; and -1 with
+// errno set if it cannot be read.
+int input_split(const char *path, off_t chunk, struct input_range **ranges);
+
+#endif
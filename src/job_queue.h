@@ -6,31 +6,46 @@
 struct job_queue {
   volatile unsigned int capacity;
   volatile unsigned int size;
-  volatile int destroyed;
+  volatile int closed;
+  volatile int cancelled;
   void **data;
-  pthread_mutex_t *mutex;
-  pthread_cond_t *cond_job_popped;
-  pthread_cond_t *cond_job_pushed;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond_job_popped;
+  pthread_cond_t cond_job_pushed;
 };
 
 // Initialise a job queue with the given capacity.  The queue starts out
 // empty.  Returns non-zero on error.
 int job_queue_init(struct job_queue *job_queue, int capacity);
 
-// Destroy the job queue.  Blocks until the queue is empty before it
-// is destroyed.
+// Close the job queue: no more jobs may be pushed.  Blocks until the
+// queue is empty, after which every blocked or later pop fails with
+// -1, so that the workers see there is no more work.  Returns non-zero
+// on error.
+int job_queue_close(struct job_queue *job_queue);
+
+// Destroy the job queue, freeing what job_queue_init() set up.  No
+// thread may use the queue any longer: close it, and join the workers,
+// first.  Returns non-zero on error.
 int job_queue_destroy(struct job_queue *job_queue);
 
+// Cancel the job queue: the pending jobs are handed to 'discard' (if
+// non-NULL) and dropped, and every blocked or later push and pop fails
+// with -1.  Used to stop early, once the result is known.  The queue
+// must still be closed and destroyed afterwards.  Returns non-zero on error.
+int job_queue_cancel(struct job_queue *job_queue, void (*discard)(void *data));
+
 // Push an element onto the end of the job queue.  Blocks if the
 // job_queue is full (its size is equal to its capacity).  Returns
 // non-zero on error.  It is an error to push a job onto a queue that
-// has been destroyed.
+// has been closed or cancelled.
 int job_queue_push(struct job_queue *job_queue, void *data);
 
 // Pop an element from the front of the job queue.  Blocks if the
 // job_queue contains zero elements.  Returns non-zero on error.  If
-// job_queue_destroy() has been called (possibly after the call to
-// job_queue_pop() blocked), this function will return -1.
+// job_queue_close() or job_queue_cancel() has been called (possibly
+// after the call to job_queue_pop() blocked), this function will
+// return -1.
 int job_queue_pop(struct job_queue *job_queue, void **data);
 
 #endif
@@ -0,0 +1,182 @@
+// Checks the matchers behind fauxgrep-mt: ere_match() against a table
+// of patterns and lines, and search_ci() against a plain byte-by-byte
+// search on lines of every length and alignment.  Run by 'make test';
+// prints what failed, and exits non-zero if anything did.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// err.h contains various nonstandard BSD extensions, but they are
+// very handy.
+#include <err.h>
+
+#include "ere.h"
+#include "search.h"
+
+static int failures = 0;
+
+struct ere_case {
+  const char *pattern;
+  int flags;
+  const char *line;
+  int match;
+};
+
+static const struct ere_case ere_cases[] = {
+    // Anchors.
+    {"^abc", 0, "abcdef", 1},
+    {"^abc", 0, "xabc", 0},
+    {"abc$", 0, "xxabc", 1},
+    {"abc$", 0, "abcx", 0},
+    {"^$", 0, "", 1},
+    {"^$", 0, "a", 0},
+    {"^a.c$", 0, "abc", 1},
+    {"^a.c$", 0, "abbc", 0},
+    {"x^", 0, "x", 0},
+
+    // Alternation and grouping.
+    {"cat|dog", 0, "hotdog", 1},
+    {"cat|dog", 0, "cow", 0},
+    {"^(cat|dog)s?$", 0, "dogs", 1},
+    {"^(cat|dog)s?$", 0, "cats!", 0},
+    {"a(b|cd)e", 0, "acde", 1},
+    {"a(b|cd)e", 0, "abde", 0},
+    {"^(ab|a)(c|bcd)$", 0, "abcd", 1},
+
+    // Bracket expressions and escapes.
+    {"[0-9]+", 0, "abc", 0},
+    {"[0-9]+", 0, "a1", 1},
+    {"^[[:alpha:]]+$", 0, "Hello", 1},
+    {"^[[:alpha:]]+$", 0, "Hel1o", 0},
+    {"[^a-z]", 0, "abc", 0},
+    {"[^a-z]", 0, "abC", 1},
+    {"[[:space:]]x", 0, "a x", 1},
+    {"^\\d{3}-\\d{4}$", 0, "555-1234", 1},
+    {"^\\d{3}-\\d{4}$", 0, "55-1234", 0},
+    {"\\s", 0, "ab", 0},
+    {"^\\w+$", 0, "snake_case9", 1},
+
+    // Repetition.
+    {"^a{2,3}$", 0, "aaa", 1},
+    {"^a{2,3}$", 0, "aaaa", 0},
+    {"ab*c", 0, "ac", 1},
+    {"ab+c", 0, "ac", 0},
+    {"colou?r", 0, "color", 1},
+    {"^a{2$", 0, "a{2", 1}, // Not a bound, so literal, as in GNU grep.
+
+    // -i.
+    {"hello", ERE_ICASE, "HeLLo world", 1},
+    {"hello", 0, "HELLO", 0},
+    {"^[a-c]+$", ERE_ICASE, "ABCabc", 1},
+    {"^[A-C]+$", ERE_ICASE, "abd", 0},
+    {"(foo|bar)baz", ERE_ICASE, "xBARBAZ", 1},
+    {"^[^a]$", ERE_ICASE, "A", 0},
+    {"^[@-Z]$", ERE_ICASE, "`", 0},
+};
+
+// Patterns that ere_compile() must reject.
+static const char *const ere_errors[] = {"(", "a)", "[a", "*a"};
+
+static void check_ere(void) {
+  size_t n = sizeof(ere_cases) / sizeof(ere_cases[0]);
+  for (size_t i = 0; i < n; i++) {
+    const struct ere_case *c = &ere_cases[i];
+    struct ere re;
+    if (ere_compile(&re, c->pattern, c->flags) != 0) {
+      warnx("ere: '%s' does not compile: %s", c->pattern, re.error);
+      failures++;
+      continue;
+    }
+    int got = ere_match(&re, c->line, strlen(c->line));
+    if (got != c->match) {
+      warnx("ere: '%s'%s on \"%s\": %d, expected %d", c->pattern,
+            c->flags & ERE_ICASE ? " (-i)" : "", c->line, got, c->match);
+      failures++;
+    }
+    ere_free(&re);
+  }
+
+  n = sizeof(ere_errors) / sizeof(ere_errors[0]);
+  for (size_t i = 0; i < n; i++) {
+    struct ere re;
+    if (ere_compile(&re, ere_errors[i], 0) == 0) {
+      warnx("ere: '%s' compiles", ere_errors[i]);
+      failures++;
+      ere_free(&re);
+    }
+  }
+}
+
+static unsigned char fold(unsigned char c) {
+  return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+// The obvious search, to check search_ci() against.
+static const char *naive_ci(const char *h, size_t hlen, const char *n,
+                            size_t nlen) {
+  for (size_t i = 0; i + nlen <= hlen; i++) {
+    size_t j = 0;
+    while (j < nlen && fold((unsigned char)h[i + j]) == (unsigned char)n[j])
+      j++;
+    if (j == nlen)
+      return h + i;
+  }
+  return NULL;
+}
+
+// A small LCG, so that every run checks the same lines.
+static unsigned next(unsigned *state) {
+  *state = *state * 1103515245 + 12345;
+  return (*state >> 16) & 0x7fff;
+}
+
+static void check_search_ci(void) {
+  // Letters of both cases, and the bytes on either side of 'A'..'Z'
+  // and 'a'..'z', which must not be folded: '@' '[' '`' '{', and two
+  // that differ from letters only in the top bit.
+  static const char alphabet[] = "aAbBzZ@[`{\xc1\xe1";
+  unsigned state = 1;
+
+  for (int round = 0; round < 20000; round++) {
+    size_t hlen = next(&state) % 80;
+    // Exactly 'hlen' bytes, so that reading past them shows up under
+    // valgrind or ASan.
+    char *h = malloc(hlen > 0 ? hlen : 1);
+    char needle[24];
+    if (h == NULL)
+      err(1, "malloc() failed");
+    for (size_t i = 0; i < hlen; i++)
+      h[i] = alphabet[next(&state) % (sizeof(alphabet) - 1)];
+
+    size_t nlen = 1 + next(&state) % 20;
+    if (hlen >= nlen && next(&state) % 2) {
+      // Half the time, a piece of the line, so there is a match.
+      memcpy(needle, h + next(&state) % (hlen - nlen + 1), nlen);
+    } else {
+      for (size_t i = 0; i < nlen; i++)
+        needle[i] = alphabet[next(&state) % (sizeof(alphabet) - 1)];
+    }
+    search_fold(needle, nlen);
+
+    const char *got = search_ci(h, hlen, needle, nlen);
+    const char *want = naive_ci(h, hlen, needle, nlen);
+    if (got != want) {
+      warnx("search_ci: needle of %zu bytes in a line of %zu: found at "
+            "%ld, expected %ld",
+            nlen, hlen, got ? (long)(got - h) : -1L,
+            want ? (long)(want - h) : -1L);
+      failures++;
+    }
+    free(h);
+  }
+}
+
+int main(void) {
+  check_ere();
+  check_search_ci();
+  if (failures > 0)
+    errx(1, "%d checks failed", failures);
+  printf("ere_match and search_ci: all checks passed\n");
+  return 0;
+}
@@ -0,0 +1,766 @@
+// scan-daemon serves the requests of fauxgrep-mt, fhistogram-mt and
+// fibs over a Unix domain socket, so that a stream of small queries
+// does not pay for starting threads, building a job queue and
+// compiling regexes every time.  See scand.h for the protocol.
+//
+// One pool of worker threads serves all clients.  Each client
+// connection gets a session thread, which walks the requested paths
+// and pushes one task per file (or input line) onto the pool's job
+// queue.  A session may only have its fair share of the pool's tasks
+// outstanding at once, so a huge scan cannot starve small ones.
+
+// Setting _DEFAULT_SOURCE is necessary to activate visibility of
+// certain header file contents on GNU/Linux systems.
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fts.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// err.h contains various nonstandard BSD extensions, but they are
+// very handy.
+#include <err.h>
+
+#include <pthread.h>
+
+#include "ere.h"
+#include "fib.h"
+#include "grep.h"
+#include "input.h"
+#include "job_queue.h"
+#include "scand.h"
+#include "stats.h"
+#include "walk.h"
+
+// Number of compiled regexes kept resident between requests.  Each
+// holds at most ERE_CACHE_BYTES of DFA states.
+#define RE_CACHE_SIZE 8
+
+// Output of a task is sent to the client in frames of about this size.
+#define OUT_FLUSH 65536
+
+// Upper bound on the size of a request header.
+#define MAX_REQUEST (1 << 20)
+
+struct session {
+  int fd;
+  pthread_mutex_t lock; // Protects the fields below and writes to 'fd'.
+  pthread_cond_t cond;  // Broadcast whenever one of our tasks is done.
+  int inflight;         // Tasks pushed but not yet finished.
+  // Flags that workers set and everyone reads without the lock.
+  atomic_int broken;    // The client went away; skip remaining work.
+  atomic_int done;      // The answer is known (grep -q); skip the rest.
+  atomic_int matched;   // Some file matched, for the exit status of -q.
+  atomic_int failed;    // Some file could not be opened or read.
+  struct stats stats;
+  enum input_io io;     // How histogram_task() reads (grep has its own).
+  struct grep grep;
+};
+
+struct outbuf {
+  char *data;
+  size_t len;
+  size_t cap;
+};
+
+struct task {
+  void (*run)(struct task *t);
+  struct session *s;
+  char *arg;       // A path, or a line of input for fib.
+  size_t display;  // Leading bytes of the path not shown to the client.
+  struct outbuf out;
+};
+
+// The worker pool, shared by all sessions.
+static struct job_queue pool;
+static int num_threads = 1;
+
+static pthread_mutex_t sessions_lock = PTHREAD_MUTEX_INITIALIZER;
+static int active_sessions = 0;
+
+//
+// Regexes stay compiled (DFA cache included) between requests.
+//
+
+struct re_entry {
+  char *pattern; // NULL if the slot is free.
+  int flags;
+  int refs;
+  unsigned long last_used;
+  struct ere re;
+};
+
+static struct re_entry re_cache[RE_CACHE_SIZE];
+static pthread_mutex_t re_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long re_clock = 0;
+
+// Find or compile the regex for 'pattern'.  Returns NULL and sets
+// '*error' if it does not compile.
+static struct ere *re_acquire(const char *pattern, int flags,
+                              const char **error) {
+  pthread_mutex_lock(&re_cache_lock);
+
+  // Pick the entry to reuse: a free slot if any, otherwise the least
+  // recently used one that no request is using right now.
+  struct re_entry *victim = NULL;
+  for (int i = 0; i < RE_CACHE_SIZE; i++) {
+    struct re_entry *e = &re_cache[i];
+    if (e->pattern != NULL && e->flags == flags &&
+        strcmp(e->pattern, pattern) == 0) {
+      e->refs++;
+      e->last_used = ++re_clock;
+      pthread_mutex_unlock(&re_cache_lock);
+      return &e->re;
+    }
+    if (e->refs > 0)
+      continue;
+    if (victim == NULL ||
+        (victim->pattern != NULL &&
+         (e->pattern == NULL || e->last_used < victim->last_used)))
+      victim = e;
+  }
+
+  struct ere *re;
+  if (victim == NULL) {
+    // Every slot is in use; this one is private to the request.
+    re = malloc(sizeof(struct ere));
+    if (re == NULL) {
+      *error = "out of memory";
+    } else if (ere_compile(re, pattern, flags) != 0) {
+      *error = re->error;
+      free(re);
+      re = NULL;
+    }
+  } else {
+    if (victim->pattern != NULL) {
+      ere_free(&victim->re);
+      free(victim->pattern);
+      victim->pattern = NULL;
+    }
+    re = NULL;
+    if (ere_compile(&victim->re, pattern, flags) != 0) {
+      *error = victim->re.error;
+    } else if ((victim->pattern = strdup(pattern)) == NULL) {
+      ere_free(&victim->re);
+      *error = "out of memory";
+    } else {
+      victim->flags = flags;
+      victim->refs = 1;
+      victim->last_used = ++re_clock;
+      re = &victim->re;
+    }
+  }
+
+  pthread_mutex_unlock(&re_cache_lock);
+  return re;
+}
+
+static void re_release(struct ere *re) {
+  pthread_mutex_lock(&re_cache_lock);
+  for (int i = 0; i < RE_CACHE_SIZE; i++) {
+    if (&re_cache[i].re == re) {
+      re_cache[i].refs--;
+      pthread_mutex_unlock(&re_cache_lock);
+      return;
+    }
+  }
+  pthread_mutex_unlock(&re_cache_lock);
+  ere_free(re);
+  free(re);
+}
+
+//
+// Talking to the client.
+//
+
+static void session_send(struct session *s, int type, const void *data,
+                         size_t len) {
+  pthread_mutex_lock(&s->lock);
+  if (!s->broken && scand_write_frame(s->fd, type, data, len) != 0)
+    s->broken = 1;
+  pthread_mutex_unlock(&s->lock);
+}
+
+static void session_error(struct session *s, const char *fmt, ...) {
+  char msg[1024];
+  int n = snprintf(msg, sizeof(msg), "scan-daemon: ");
+
+  va_list ap;
+  va_start(ap, fmt);
+  vsnprintf(msg + n, sizeof(msg) - (size_t)n - 1, fmt, ap);
+  va_end(ap);
+  strcat(msg, "\n");
+
+  session_send(s, SCAND_ERR, msg, strlen(msg));
+}
+
+static void out_write(struct outbuf *b, const void *data, size_t len) {
+  if (b->len + len > b->cap) {
+    size_t cap = b->cap ? b->cap : 4096;
+    while (cap < b->len + len)
+      cap *= 2;
+    char *bigger = realloc(b->data, cap);
+    if (bigger == NULL)
+      return;
+    b->data = bigger;
+    b->cap = cap;
+  }
+  memcpy(b->data + b->len, data, len);
+  b->len += len;
+}
+
+static void out_printf(struct outbuf *b, const char *fmt, ...) {
+  char small[256];
+  va_list ap;
+
+  va_start(ap, fmt);
+  int n = vsnprintf(small, sizeof(small), fmt, ap);
+  va_end(ap);
+  if (n < 0)
+    return;
+  if ((size_t)n < sizeof(small)) {
+    out_write(b, small, (size_t)n);
+    return;
+  }
+
+  char *big = malloc((size_t)n + 1);
+  if (big == NULL)
+    return;
+  va_start(ap, fmt);
+  vsnprintf(big, (size_t)n + 1, fmt, ap);
+  va_end(ap);
+  out_write(b, big, (size_t)n);
+  free(big);
+}
+
+static void task_flush(struct task *t) {
+  if (t->out.len > 0) {
+    session_send(t->s, SCAND_OUT, t->out.data, t->out.len);
+    t->out.len = 0;
+  }
+}
+
+//
+// Tasks, run by the worker threads.
+//
+
+// The 'emit' callback for grep_file().  Same format as grep_print(),
+// but with the path as the client gave it.
+static void task_emit(void *arg, const struct grep_match *m) {
+  struct task *t = arg;
+  const char *path = m->path + t->display;
+
+  if (m->name_only) {
+    out_printf(&t->out, "%s\n", path);
+  } else if (m->binary) {
+    out_printf(&t->out, "Binary file %s matches\n", path);
+  } else {
+    out_printf(&t->out, "%s:%d:", path, m->lineno);
+    out_write(&t->out, m->line, m->len);
+  }
+  if (t->out.len >= OUT_FLUSH)
+    task_flush(t);
+}
+
+// The 'fail' callback for grep_file(): the client reports the error,
+// as a local run would.
+static void task_fail(void *arg, const char *path, const char *what,
+                      int errnum) {
+  struct task *t = arg;
+  // Keep the matches found before the error ahead of it.
+  task_flush(t);
+  t->s->failed = 1;
+  session_error(t->s, "failed to %s %s: %s", what, path + t->display,
+                strerror(errnum));
+}
+
+static void grep_task(struct task *t) {
+  struct session *s = t->s;
+
+  if (grep_file(&s->grep, t->arg, t) == 1) {
+    s->matched = 1;
+    if (s->grep.quiet) {
+      // The pool is shared, so the session's queued tasks cannot be
+      // pulled out of it; they are skipped by worker() instead.
+      s->grep.stop = 1;
+      s->done = 1;
+    }
+  }
+}
+
+// Merge 'local' into the session's totals, and send the client the bit
+// counts to redraw.  Done under the session lock, so the client sees
+// the totals grow monotonically.
+static void histogram_merge(struct session *s, struct stats *local) {
+  pthread_mutex_lock(&s->lock);
+  stats_merge(local, &s->stats);
+  if (s->stats.which & STATS_BITS) {
+    int64_t bits[8];
+    stats_bits(&s->stats, bits);
+    if (!s->broken &&
+        scand_write_frame(s->fd, SCAND_HISTOGRAM, bits, sizeof(bits)) != 0)
+      s->broken = 1;
+  }
+  pthread_mutex_unlock(&s->lock);
+}
+
+static void histogram_task(struct task *t) {
+  struct session *s = t->s;
+  FILE *f = input_open(t->arg, s->io);
+
+  if (f == NULL) {
+    session_error(s, "failed to open %s: %s", t->arg + t->display,
+                  strerror(errno));
+    return;
+  }
+
+  struct stats local;
+  unsigned char buf[65536];
+  size_t n;
+
+  // Block by block, like fhistogram-mt, so that the client redraws as
+  // often as a local run would.
+  stats_init(&local, s->stats.which);
+  stats_begin_file(&local);
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+    stats_update(&local, buf, n);
+    histogram_merge(s, &local);
+  }
+  if (ferror(f))
+    session_error(s, "failed to read %s: %s", t->arg + t->display,
+                  strerror(errno));
+  fclose(f);
+  stats_end_file(&local);
+  histogram_merge(s, &local);
+}
+
+static void fib_task(struct task *t) {
+  int n = atoi(t->arg);
+  out_printf(&t->out, "fib(%d) = %d\n", n, fib(n));
+}
+
+static void *worker(void *arg) {
+  (void)arg;
+  struct task *t;
+
+  while (job_queue_pop(&pool, (void **)&t) == 0) {
+    struct session *s = t->s;
+
+    if (!s->broken && !s->done) {
+      t->run(t);
+      task_flush(t);
+    }
+    free(t->arg);
+    free(t->out.data);
+    free(t);
+
+    pthread_mutex_lock(&s->lock);
+    s->inflight--;
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+  }
+  return NULL;
+}
+
+//
+// Sessions.
+//
+
+// How many tasks a session may have outstanding: twice the pool size,
+// split evenly between the clients connected right now.
+static int fair_share(void) {
+  pthread_mutex_lock(&sessions_lock);
+  int share = 2 * num_threads / (active_sessions > 0 ? active_sessions : 1);
+  pthread_mutex_unlock(&sessions_lock);
+  return share > 0 ? share : 1;
+}
+
+// Queue 'run' on 'arg' (which the task takes ownership of).  Blocks
+// while the session has used up its fair share.  Returns non-zero if
+// the task could not be queued.
+static int session_submit(struct session *s, void (*run)(struct task *),
+                          char *arg, size_t display) {
+  struct task *t = calloc(1, sizeof(struct task));
+  if (t == NULL) {
+    free(arg);
+    return -1;
+  }
+  t->run = run;
+  t->s = s;
+  t->arg = arg;
+  t->display = display;
+
+  pthread_mutex_lock(&s->lock);
+  while (s->inflight >= fair_share())
+    pthread_cond_wait(&s->cond, &s->lock);
+  s->inflight++;
+  pthread_mutex_unlock(&s->lock);
+
+  if (job_queue_push(&pool, t) != 0) {
+    pthread_mutex_lock(&s->lock);
+    s->inflight--;
+    pthread_mutex_unlock(&s->lock);
+    free(t->arg);
+    free(t);
+    return -1;
+  }
+  return 0;
+}
+
+// Wait for all tasks of the session to finish.
+static void session_wait(struct session *s) {
+  pthread_mutex_lock(&s->lock);
+  while (s->inflight > 0)
+    pthread_cond_wait(&s->cond, &s->lock);
+  pthread_mutex_unlock(&s->lock);
+}
+
+// Walk 'roots' (relative to the client's 'cwd') and submit a task for
+// every regular file.  If 'announce' is set, each file is also shown
+// to the client after it, as a local run shows what it queues.
+static void session_walk(struct session *s, const char *cwd,
+                         char *const *roots, int nroots, struct walk *walk,
+                         const char *announce, void (*run)(struct task *)) {
+  for (int i = 0; i < nroots && !s->broken && !s->done; i++) {
+    // Relative paths are resolved against the client's directory, and
+    // shown to it without that prefix again.
+    char *full;
+    size_t display = 0;
+    if (roots[i][0] == '/') {
+      full = strdup(roots[i]);
+    } else {
+      display = strlen(cwd) + 1;
+      full = malloc(display + strlen(roots[i]) + 1);
+      if (full != NULL)
+        sprintf(full, "%s/%s", cwd, roots[i]);
+    }
+    if (full == NULL)
+      break;
+
+    // FTS_LOGICAL = follow symbolic links
+    // FTS_NOCHDIR = do not change the working directory of the process
+    char *paths[] = {full, NULL};
+    FTS *ftsp = fts_open(paths, FTS_LOGICAL | FTS_NOCHDIR, NULL);
+    if (ftsp == NULL) {
+      session_error(s, "fts_open() failed: %s", strerror(errno));
+      free(full);
+      break;
+    }
+
+    FTSENT *p;
+    while (!s->broken && !s->done && (p = fts_read(ftsp)) != NULL) {
+      // Copies (--dedup-content) are weeded out here, by the walker,
+      // since a task cannot drop its own output once it has begun.
+      if (walk_visit(walk, ftsp, p) && p->fts_info == FTS_F &&
+          !walk_duplicate(walk, p->fts_path, p->fts_statp->st_size,
+                          walk->peer)) {
+        char *copy = strdup(p->fts_path);
+        if (copy == NULL || session_submit(s, run, copy, display) != 0)
+          break;
+        if (announce != NULL) {
+          const char *path = p->fts_path + display;
+          char *line = malloc(strlen(announce) + strlen(path) + 2);
+          if (line != NULL) {
+            sprintf(line, "%s%s\n", announce, path);
+            session_send(s, SCAND_OUT, line, strlen(line));
+            free(line);
+          }
+        }
+      }
+    }
+
+    fts_close(ftsp);
+    free(full);
+  }
+}
+
+static int run_grep(struct session *s, const char *cwd, int argc,
+                    char *const *argv) {
+  int first_path = grep_parse(&s->grep, argc, argv, NULL);
+  if (first_path < 0) {
+    session_error(s, "%s", s->grep.error);
+    grep_free(&s->grep);
+    return 1;
+  }
+  if (s->grep.follow || s->grep.shard.num > 0 || s->grep.partial != NULL) {
+    // Clients run these themselves rather than tie up a session.
+    session_error(s, "%s is not supported by scan-daemon",
+                  s->grep.follow ? "--follow" : "--shard or --partial");
+    grep_free(&s->grep);
+    return 1;
+  }
+
+  if (s->grep.use_regex) {
+    const char *error = NULL;
+    int flags = s->grep.icase ? ERE_ICASE : 0;
+    s->grep.re = re_acquire(s->grep.needle, flags, &error);
+    if (s->grep.re == NULL) {
+      session_error(s, "invalid regex '%s': %s", s->grep.needle, error);
+      grep_free(&s->grep);
+      return 1;
+    }
+  }
+  s->grep.emit = task_emit;
+  s->grep.fail = task_fail;
+
+  session_walk(s, cwd, &argv[first_path], argc - first_path, &s->grep.walk,
+               NULL, grep_task);
+  session_wait(s);
+
+  if (s->grep.re != NULL)
+    re_release(s->grep.re);
+  grep_free(&s->grep);
+  return grep_status((s->grep.quiet ? GREP_QUIET : 0) |
+                     (s->matched ? GREP_MATCHED : 0) |
+                     (s->failed ? GREP_FAILED : 0));
+}
+
+static int run_histogram(struct session *s, const char *cwd, int argc,
+                         char *const *argv) {
+  // The thread count is the daemon's business.
+  struct stats_args args;
+  const char *error;
+  int first_path = stats_parse_args(argc, argv, &args, &error);
+  if (first_path < 0) {
+    session_error(s, "%s", error);
+    walk_free(&args.walk);
+    return 1;
+  }
+  if (args.follow || args.sample > 0 || args.shard.num > 0 ||
+      args.partial != NULL) {
+    // Clients run these themselves.
+    session_error(s, "%s is not supported by scan-daemon",
+                  args.follow       ? "--follow"
+                  : args.sample > 0 ? "--sample"
+                                    : "--shard or --partial");
+    walk_free(&args.walk);
+    return 1;
+  }
+  unsigned which = args.which;
+  stats_init(&s->stats, which);
+  s->io = args.io;
+
+  session_walk(s, cwd, &argv[first_path], argc - first_path, &args.walk,
+               "Queued file: ", histogram_task);
+  session_wait(s);
+
+  // The client draws and reports the final totals itself, exactly as
+  // at the end of a local run.  They are always sent, even if no file
+  // was read.
+  char *saved = NULL;
+  size_t len = 0;
+  FILE *out = open_memstream(&saved, &len);
+  if (out == NULL) {
+    session_error(s, "open_memstream() failed: %s", strerror(errno));
+    walk_free(&args.walk);
+    return 1;
+  }
+  stats_save(out, &s->stats);
+  fclose(out);
+  session_send(s, SCAND_STATS, saved, len);
+  free(saved);
+  walk_free(&args.walk);
+  return 0;
+}
+
+static int run_fib(struct session *s, FILE *in) {
+  char *line = NULL;
+  size_t buf_len = 0;
+
+  while (!s->broken && getline(&line, &buf_len, in) != -1) {
+    char *copy = strdup(line);
+    if (copy == NULL || session_submit(s, fib_task, copy, 0) != 0)
+      break;
+  }
+  free(line);
+
+  session_wait(s);
+  return 0;
+}
+
+static void *session_main(void *arg) {
+  struct session *s = arg;
+  int status = 1;
+
+  pthread_mutex_lock(&sessions_lock);
+  active_sessions++;
+  pthread_mutex_unlock(&sessions_lock);
+
+  // The header is a sequence of NUL-terminated strings, ended by an
+  // empty one: working directory, command, arguments.
+  FILE *in = fdopen(dup(s->fd), "r");
+  char **args = NULL;
+  int nargs = 0;
+  size_t total = 0;
+  int complete = 0;
+
+  while (in != NULL && total < MAX_REQUEST) {
+    char *str = NULL;
+    size_t n = 0;
+    ssize_t len = getdelim(&str, &n, '\0', in);
+    if (len <= 0 || str[len - 1] != '\0') {
+      free(str);
+      break;
+    }
+    if (len == 1) {
+      free(str);
+      complete = 1;
+      break;
+    }
+
+    char **more = realloc(args, (size_t)(nargs + 2) * sizeof(char *));
+    if (more == NULL) {
+      free(str);
+      break;
+    }
+    args = more;
+    args[nargs++] = str;
+    args[nargs] = NULL;
+    total += (size_t)len;
+  }
+
+  if (!complete || nargs < 2) {
+    session_error(s, "malformed request");
+  } else if (strcmp(args[1], "grep") == 0) {
+    // The command name takes the place of the program name.
+    status = run_grep(s, args[0], nargs - 1, &args[1]);
+  } else if (strcmp(args[1], "histogram") == 0) {
+    status = run_histogram(s, args[0], nargs - 1, &args[1]);
+  } else if (strcmp(args[1], "fib") == 0) {
+    status = run_fib(s, in);
+  } else {
+    session_error(s, "unknown command '%s'", args[1]);
+  }
+
+  int32_t code = status;
+  session_send(s, SCAND_EXIT, &code, sizeof(code));
+
+  for (int i = 0; i < nargs; i++)
+    free(args[i]);
+  free(args);
+  if (in != NULL)
+    fclose(in);
+  close(s->fd);
+  pthread_cond_destroy(&s->cond);
+  pthread_mutex_destroy(&s->lock);
+  free(s);
+
+  pthread_mutex_lock(&sessions_lock);
+  active_sessions--;
+  pthread_mutex_unlock(&sessions_lock);
+  return NULL;
+}
+
+#define USAGE "usage: [-n INT] SOCKET"
+
+int main(int argc, char *const *argv) {
+  if (argc < 2) {
+    err(1, USAGE);
+    exit(1);
+  }
+
+  const char *path = argv[1];
+
+  if (strcmp(argv[1], "-n") == 0) {
+    // '-n 4' with no SOCKET after it must not listen on "-n".
+    if (argc != 4) {
+      errx(1, USAGE);
+    }
+    // Since atoi() simply returns zero on syntax errors, we cannot
+    // distinguish between the user entering a zero, or some
+    // non-numeric garbage.  A more robust solution would use
+    // strtol(), but its interface is more complicated, so here we
+    // are.
+    num_threads = atoi(argv[2]);
+
+    if (num_threads < 1) {
+      err(1, "invalid thread count: %s", argv[2]);
+    }
+
+    path = argv[3];
+  }
+
+  // A client hanging up must not kill the daemon.
+  signal(SIGPIPE, SIG_IGN);
+
+  // Start the worker pool; it lives as long as the daemon.
+  if (job_queue_init(&pool, 64) != 0) {
+    errx(1, "job_queue_init() failed");
+  }
+  for (int i = 0; i < num_threads; i++) {
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, worker, NULL) != 0) {
+      err(1, "pthread_create() failed");
+    }
+    pthread_detach(tid);
+  }
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    errx(1, "socket path too long: %s", path);
+  }
+  strcpy(addr.sun_path, path);
+
+  int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listener < 0) {
+    err(1, "socket() failed");
+  }
+  // Remove a stale socket left behind by an earlier daemon, but
+  // nothing else: a mistyped path must not cost a file.
+  struct stat st;
+  if (lstat(path, &st) == 0) {
+    if (!S_ISSOCK(st.st_mode)) {
+      errx(1, "%s exists and is not a socket", path);
+    }
+    unlink(path);
+  }
+  if (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    err(1, "bind() failed: %s", path);
+  }
+  if (listen(listener, SOMAXCONN) != 0) {
+    err(1, "listen() failed");
+  }
+
+  while (1) {
+    int fd = accept(listener, NULL, NULL);
+    if (fd < 0) {
+      if (errno != EINTR)
+        warn("accept() failed");
+      continue;
+    }
+
+    struct session *s = calloc(1, sizeof(struct session));
+    if (s == NULL) {
+      close(fd);
+      continue;
+    }
+    s->fd = fd;
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->cond, NULL);
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, session_main, s) != 0) {
+      warn("pthread_create() failed");
+      close(fd);
+      pthread_cond_destroy(&s->cond);
+      pthread_mutex_destroy(&s->lock);
+      free(s);
+      continue;
+    }
+    pthread_detach(tid);
+  }
+}
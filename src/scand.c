@@ -0,0 +1,184 @@
+// Setting _DEFAULT_SOURCE is necessary to activate visibility of
+// certain header file contents on GNU/Linux systems.
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// err.h contains various nonstandard BSD extensions, but they are
+// very handy.
+#include <err.h>
+
+#include "scand.h"
+
+int scand_write_full(int fd, const void *buf, size_t len) {
+  const char *p = buf;
+  while (len > 0) {
+    // MSG_NOSIGNAL: a client that went away is an error, not SIGPIPE.
+    ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+    if (n < 0 && errno == ENOTSOCK) {
+      n = write(fd, p, len);
+    }
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    p += n;
+    len -= (size_t)n;
+  }
+  return 0;
+}
+
+int scand_read_full(int fd, void *buf, size_t len) {
+  char *p = buf;
+  while (len > 0) {
+    ssize_t n = read(fd, p, len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return -1;
+    p += n;
+    len -= (size_t)n;
+  }
+  return 0;
+}
+
+int scand_write_frame(int fd, int type, const void *data, size_t len) {
+  unsigned char header[1 + sizeof(uint32_t)];
+  uint32_t len32 = (uint32_t)len;
+
+  header[0] = (unsigned char)type;
+  memcpy(header + 1, &len32, sizeof(len32));
+  if (scand_write_full(fd, header, sizeof(header)) != 0)
+    return -1;
+  return scand_write_full(fd, data, len);
+}
+
+// Send the request header: working directory, command and arguments.
+static int send_request(int fd, const char *command, int argc,
+                        char *const *argv) {
+  char *cwd = getcwd(NULL, 0);
+  if (cwd == NULL)
+    return -1;
+
+  int rc = scand_write_full(fd, cwd, strlen(cwd) + 1);
+  free(cwd);
+
+  if (rc == 0)
+    rc = scand_write_full(fd, command, strlen(command) + 1);
+  for (int i = 1; rc == 0 && i < argc; i++)
+    rc = scand_write_full(fd, argv[i], strlen(argv[i]) + 1);
+  if (rc == 0)
+    rc = scand_write_full(fd, "", 1);
+  return rc;
+}
+
+static int send_stdin_to(int fd) {
+  char buf[65536];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), stdin)) > 0) {
+    if (scand_write_full(fd, buf, n) != 0)
+      return -1;
+  }
+  return ferror(stdin) ? -1 : 0;
+}
+
+int scand_forward(const char *command, int argc, char *const *argv,
+                  int send_stdin,
+                  void (*frame)(int type, const void *data, size_t len)) {
+  const char *path = getenv(SCAND_SOCKET_ENV);
+  if (path == NULL || *path == '\0')
+    return -1;
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    warnx("%s too long, running locally", SCAND_SOCKET_ENV);
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    warn("cannot reach scan-daemon at %s, running locally", path);
+    close(fd);
+    return -1;
+  }
+
+  // Everything from here on has been handed over to the daemon, so
+  // failures are reported rather than retried locally.
+  if (send_request(fd, command, argc, argv) != 0 ||
+      (send_stdin && send_stdin_to(fd) != 0)) {
+    warn("failed to send request to scan-daemon");
+    close(fd);
+    return 1;
+  }
+  shutdown(fd, SHUT_WR);
+
+  int status = -1;
+  char *buf = NULL;
+  size_t cap = 0;
+
+  while (status < 0) {
+    unsigned char header[1 + sizeof(uint32_t)];
+    uint32_t len;
+
+    if (scand_read_full(fd, header, sizeof(header)) != 0)
+      break;
+    memcpy(&len, header + 1, sizeof(len));
+    if (len > cap) {
+      char *bigger = realloc(buf, len);
+      if (bigger == NULL)
+        break;
+      buf = bigger;
+      cap = len;
+    }
+    if (scand_read_full(fd, buf, len) != 0)
+      break;
+
+    switch (header[0]) {
+    case SCAND_OUT:
+      fwrite(buf, 1, len, stdout);
+      break;
+    case SCAND_ERR:
+      fflush(stdout);
+      fwrite(buf, 1, len, stderr);
+      break;
+    case SCAND_HISTOGRAM:
+    case SCAND_STATS:
+      if (frame != NULL)
+        frame(header[0], buf, len);
+      break;
+    case SCAND_EXIT:
+      if (len == sizeof(int32_t)) {
+        int32_t code;
+        memcpy(&code, buf, sizeof(code));
+        status = code < 0 ? 1 : code;
+      }
+      break;
+    default:
+      break;
+    }
+  }
+
+  free(buf);
+  close(fd);
+
+  if (status < 0) {
+    warnx("scan-daemon closed the connection");
+    status = 1;
+  }
+  return status;
+}
@@ -0,0 +1,54 @@
+#ifndef SCAND_H
+#define SCAND_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// scan-daemon keeps a warm pool of worker threads (and any compiled
+// regexes) resident, and serves grep, histogram and fib requests over
+// a Unix domain socket.  fauxgrep-mt, fhistogram-mt and fibs become
+// thin clients of it when SCAND_SOCKET is set in the environment.
+//
+// The client sends its working directory, the command name ("grep",
+// "histogram" or "fib") and its arguments, each as a NUL-terminated
+// string, followed by an empty string.  A "fib" request continues
+// with the client's standard input.  The client then shuts down its
+// side of the connection.
+//
+// The daemon answers with a stream of frames, each a one byte type,
+// a uint32_t payload length in host byte order, and the payload.  The
+// last frame is always SCAND_EXIT.
+
+// Environment variable naming the socket of a running scan-daemon.
+#define SCAND_SOCKET_ENV "SCAND_SOCKET"
+
+enum scand_frame {
+  SCAND_OUT = 'o',       // Bytes for standard output.
+  SCAND_ERR = 'e',       // Bytes for standard error.
+  SCAND_HISTOGRAM = 'h', // Eight int64_t bit counts, to be displayed.
+  SCAND_STATS = 's',     // The final totals, as written by stats_save().
+  SCAND_EXIT = 'x'       // int32_t exit status.
+};
+
+// Write all 'len' bytes at 'buf' to 'fd'.  Returns non-zero on error.
+int scand_write_full(int fd, const void *buf, size_t len);
+
+// Read exactly 'len' bytes from 'fd'.  Returns non-zero on error or
+// premature end of file.
+int scand_read_full(int fd, void *buf, size_t len);
+
+// Write a single frame.  Returns non-zero on error.
+int scand_write_frame(int fd, int type, const void *data, size_t len);
+
+// If SCAND_SOCKET is set and a daemon is listening there, run
+// 'command' with the arguments 'argv[1..argc)' on the daemon, relay
+// its output, and return the exit status.  If 'send_stdin' is set,
+// standard input is passed along.  Histogram and stats frames are
+// handed to 'frame', which may be NULL for commands that never send
+// them, so that the client draws them as it would its own.  Returns
+// -1, having done nothing, if there is no daemon to talk to.
+int scand_forward(const char *command, int argc, char *const *argv,
+                  int send_stdin,
+                  void (*frame)(int type, const void *data, size_t len));
+
+#endif
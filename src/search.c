@@ -0,0 +1,122 @@
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "search.h"
+
+static int fold(unsigned char c) {
+  return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+// Control characters that regularly show up in text files: \b \t \n
+// \v \f \r, and ESC for terminal colour codes in logs.
+static int text_control(unsigned char c) {
+  return (c >= '\b' && c <= '\r') || c == 27;
+}
+
+int search_looks_binary(const char *buf, size_t len) {
+  // memchr() is vectorised by the C library, so this is the fast
+  // test that catches nearly all binary formats.
+  if (memchr(buf, '\0', len) != NULL) {
+    return 1;
+  }
+
+  size_t odd = 0;
+  for (size_t i = 0; i < len; i++) {
+    unsigned char c = (unsigned char)buf[i];
+    if ((c < 32 && !text_control(c)) || c == 127) {
+      odd++;
+    }
+  }
+
+  // More than one odd byte in 32 is not text in any encoding we
+  // care about.
+  return odd * 32 > len;
+}
+
+void search_fold(char *buf, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    buf[i] = (char)fold((unsigned char)buf[i]);
+  }
+}
+
+#if defined(__SSE2__)
+// Lower-case the ASCII letters in 16 bytes at once.  Adding 128 - 'A'
+// maps 'A'..'Z' to the 26 smallest signed bytes, so one signed
+// comparison finds them.
+static __m128i fold16(__m128i x) {
+  __m128i t = _mm_add_epi8(x, _mm_set1_epi8((char)(128 - 'A')));
+  __m128i upper = _mm_cmplt_epi8(t, _mm_set1_epi8((char)(-128 + 26)));
+  return _mm_or_si128(x, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+#endif
+
+// Compare 'n' bytes of 'a' against the already folded 'b'.
+static int ci_equal(const char *a, const char *b, size_t n) {
+  size_t i = 0;
+
+#if defined(__SSE2__)
+  for (; i + 16 <= n; i += 16) {
+    __m128i x = fold16(_mm_loadu_si128((const __m128i *)(a + i)));
+    __m128i y = _mm_loadu_si128((const __m128i *)(b + i));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) != 0xFFFF) {
+      return 0;
+    }
+  }
+#endif
+
+  for (; i < n; i++) {
+    if (fold((unsigned char)a[i]) != (unsigned char)b[i]) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+const char *search_ci(const char *haystack, size_t hlen, const char *needle,
+                      size_t nlen) {
+  if (nlen == 0) {
+    return haystack;
+  }
+  if (nlen > hlen) {
+    return NULL;
+  }
+
+  // Last position at which a match could start.
+  size_t last = hlen - nlen;
+  size_t i = 0;
+
+#if defined(__SSE2__)
+  // Test 16 candidate positions at a time by comparing both the
+  // first and the last byte of the needle, and only verify the
+  // positions where both agree.
+  __m128i first = _mm_set1_epi8(needle[0]);
+  __m128i final = _mm_set1_epi8(needle[nlen - 1]);
+
+  for (; i + 16 <= last + 1; i += 16) {
+    __m128i a = fold16(_mm_loadu_si128((const __m128i *)(haystack + i)));
+    __m128i b = fold16(
+        _mm_loadu_si128((const __m128i *)(haystack + i + nlen - 1)));
+    unsigned mask = (unsigned)_mm_movemask_epi8(
+        _mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, final)));
+
+    while (mask != 0) {
+      size_t j = i + (size_t)__builtin_ctz(mask);
+      if (ci_equal(haystack + j, needle, nlen)) {
+        return haystack + j;
+      }
+      mask &= mask - 1;
+    }
+  }
+#endif
+
+  for (; i <= last; i++) {
+    if (fold((unsigned char)haystack[i]) == (unsigned char)needle[0] &&
+        ci_equal(haystack + i, needle, nlen)) {
+      return haystack + i;
+    }
+  }
+  return NULL;
+}
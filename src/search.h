@@ -0,0 +1,26 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <stddef.h>
+
+// Number of bytes at the start of a file that search_looks_binary()
+// should be given.
+#define SEARCH_SNIFF_BYTES 4096
+
+// Returns non-zero if the 'len' bytes at 'buf' look like binary data
+// rather than text: they contain a NUL byte, or a sizable fraction of
+// control characters that do not occur in text.  Bytes with the high
+// bit set are assumed to be UTF-8 and count as text.
+int search_looks_binary(const char *buf, size_t len);
+
+// Lower-case the ASCII letters of the 'len' bytes at 'buf' in place.
+void search_fold(char *buf, size_t len);
+
+// Find the first occurrence of 'needle' in 'haystack', ignoring the
+// case of ASCII letters.  'needle' must already be folded with
+// search_fold().  Returns NULL if there is no occurrence.  Uses SSE2
+// where available, so no copy of the haystack is ever folded.
+const char *search_ci(const char *haystack, size_t hlen, const char *needle,
+                      size_t nlen);
+
+#endif
@@ -0,0 +1,224 @@
+// Setting _DEFAULT_SOURCE is necessary to activate visibility of
+// certain header file contents on GNU/Linux systems.
+#define _DEFAULT_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// err.h contains various nonstandard BSD extensions, but they are
+// very handy.
+#include <err.h>
+
+#include "shard.h"
+
+// Identifies partial result files, and their version.
+static const char magic[8] = {'S', 'C', 'A', 'N', 'P', 'R', 'T', '1'};
+
+int shard_parse(const char *arg, struct shard *s) {
+  char *end;
+  long k = strtol(arg, &end, 10);
+  if (end == arg || *end != '/')
+    return 1;
+  const char *rest = end + 1;
+  long n = strtol(rest, &end, 10);
+  if (end == rest || *end != '\0' || k < 1 || n < k || n > 65536)
+    return 1;
+
+  s->index = (int)k - 1;
+  s->num = (int)n;
+  return 0;
+}
+
+uint64_t shard_hash(uint64_t h, const void *data, size_t len) {
+  const unsigned char *p = data;
+  for (size_t i = 0; i < len; i++) {
+    h ^= p[i];
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+// The globs in order, as a later one can override an earlier one.  The
+// flags count too: "/sub" and "sub" leave the same pattern.
+static uint64_t hash_rules(uint64_t h, const struct walk_rules *r) {
+  h = shard_hash(h, &r->num, sizeof(r->num));
+  for (int i = 0; i < r->num; i++) {
+    const struct walk_glob *g = &r->globs[i];
+    int flags[] = {g->kind, g->anchored, g->dir_only, g->negate};
+    h = shard_hash(h, flags, sizeof(flags));
+    h = shard_hash(h, g->pattern, g->len + 1);
+  }
+  return h;
+}
+
+uint64_t shard_hash_walk(uint64_t h, const struct walk *w) {
+  h = hash_rules(h, &w->include);
+  h = hash_rules(h, &w->exclude);
+  const char *ignore = w->ignore_file != NULL ? w->ignore_file : "";
+  h = shard_hash(h, ignore, strlen(ignore) + 1);
+  int64_t limits[] = {w->max_depth, (int64_t)w->min_size,
+                      (int64_t)w->max_size, w->dedup_content};
+  return shard_hash(h, limits, sizeof(limits));
+}
+
+int shard_owns(const struct shard *s, const char *path, uint64_t piece) {
+  if (s->num == 0)
+    return 1;
+
+  uint64_t h = shard_hash(SHARD_HASH_INIT, path, strlen(path));
+  h = shard_hash(h, &piece, sizeof(piece));
+  // FNV-1a leaves the low bits poorly mixed.
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  return h % (uint64_t)s->num == (uint64_t)s->index;
+}
+
+void shard_put(FILE *f, uint64_t v) {
+  while (v >= 0x80) {
+    putc((int)(v & 0x7f) | 0x80, f);
+    v >>= 7;
+  }
+  putc((int)v, f);
+}
+
+void shard_put_bytes(FILE *f, const void *data, size_t len) {
+  shard_put(f, len);
+  fwrite(data, 1, len, f);
+}
+
+void shard_put_double(FILE *f, double d) {
+  uint64_t v;
+  memcpy(&v, &d, sizeof(v));
+  for (int i = 0; i < 8; i++)
+    putc((int)(v >> (8 * i)) & 0xff, f);
+}
+
+int shard_get(FILE *f, uint64_t *v) {
+  uint64_t r = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    int c = getc(f);
+    if (c == EOF)
+      return -1;
+    r |= (uint64_t)(c & 0x7f) << shift;
+    if (!(c & 0x80)) {
+      *v = r;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+int shard_get_bytes(FILE *f, char **data, size_t *len) {
+  uint64_t n;
+  if (shard_get(f, &n) != 0 || n > SIZE_MAX - 1)
+    return -1;
+
+  char *p = malloc((size_t)n + 1);
+  if (p == NULL)
+    return -1;
+  if (fread(p, 1, (size_t)n, f) != (size_t)n) {
+    free(p);
+    return -1;
+  }
+  p[n] = '\0';
+  *data = p;
+  *len = (size_t)n;
+  return 0;
+}
+
+int shard_get_double(FILE *f, double *d) {
+  uint64_t v = 0;
+  for (int i = 0; i < 8; i++) {
+    int c = getc(f);
+    if (c == EOF)
+      return -1;
+    v |= (uint64_t)c << (8 * i);
+  }
+  memcpy(d, &v, sizeof(v));
+  return 0;
+}
+
+FILE *shard_create(const char *path, const struct shard_header *h) {
+  FILE *f = fopen(path, "wb");
+  if (f == NULL)
+    return NULL;
+
+  fwrite(magic, 1, sizeof(magic), f);
+  shard_put(f, (uint64_t)h->kind);
+  shard_put(f, (uint64_t)h->shard.index);
+  shard_put(f, (uint64_t)h->shard.num);
+  shard_put(f, h->fingerprint);
+  return f;
+}
+
+void shard_merge_init(struct shard_merge *m) {
+  memset(m, 0, sizeof(struct shard_merge));
+}
+
+int shard_merge_args(struct shard_merge *m, int num_args,
+                     char *const *args) {
+  int i = 0;
+  while (i < num_args) {
+    if (strcmp(args[i], "--allow-partial") == 0) {
+      m->allow_partial = 1;
+      i++;
+    } else if (strcmp(args[i], "--") == 0) {
+      i++;
+      break;
+    } else {
+      break;
+    }
+  }
+  return i;
+}
+
+FILE *shard_merge_open(struct shard_merge *m, const char *path, int kind) {
+  FILE *f = fopen(path, "rb");
+  if (f == NULL)
+    err(1, "cannot open %s", path);
+
+  char buf[sizeof(magic)];
+  uint64_t k, index, num, fingerprint;
+  if (fread(buf, 1, sizeof(buf), f) != sizeof(buf) ||
+      memcmp(buf, magic, sizeof(magic)) != 0 || shard_get(f, &k) != 0 ||
+      shard_get(f, &index) != 0 || shard_get(f, &num) != 0 ||
+      shard_get(f, &fingerprint) != 0 || index >= num || num > 65536)
+    errx(1, "%s: not a partial result file", path);
+  if (k != (uint64_t)kind)
+    errx(1, "%s: a partial result of another tool", path);
+
+  if (m->seen == NULL) {
+    m->header.kind = kind;
+    m->header.shard.num = (int)num;
+    m->header.fingerprint = fingerprint;
+    m->seen = calloc(num, 1);
+    if (m->seen == NULL)
+      err(1, "calloc() failed");
+  } else if (num != (uint64_t)m->header.shard.num ||
+             fingerprint != m->header.fingerprint) {
+    errx(1, "%s: from a run with other paths or options", path);
+  }
+
+  if (m->seen[index])
+    errx(1, "%s: shard %d/%d was given twice", path, (int)index + 1,
+         (int)num);
+  m->seen[index] = 1;
+  m->count++;
+  return f;
+}
+
+void shard_merge_end(struct shard_merge *m) {
+  if (m->count < m->header.shard.num) {
+    if (!m->allow_partial)
+      errx(1, "only %d of %d shards were given (--allow-partial to "
+              "merge them anyway)",
+           m->count, m->header.shard.num);
+    warnx("only %d of %d shards were merged; the result is incomplete",
+          m->count, m->header.shard.num);
+  }
+  free(m->seen);
+  m->seen = NULL;
+}
@@ -0,0 +1,95 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "walk.h"
+
+// Sharded runs, for splitting a tree over several machines.  Every
+// shard is run with the same paths and options plus '--shard K/N', and
+// scans only the files (or, for fhistogram-mt, the pieces of big
+// files) that hash to it, writing what it found to a partial result
+// file with '--partial FILE'.  'merge' then combines the partials
+// into what a single run would have printed.
+//
+// Partial result files start with a header; what follows depends on
+// the tool.  Numbers are stored as LEB128 varints, and strings as a
+// varint length followed by the bytes.
+
+#define SHARD_USAGE "[--shard K/N] [--partial FILE]"
+#define SHARD_MERGE_USAGE "usage: merge [--allow-partial] PARTIALS..."
+
+// Which of 'num' shards a run is (0-based 'index').  'num' is 0 when
+// the run is not sharded.
+struct shard {
+  int index;
+  int num;
+};
+
+#define SHARD_HISTOGRAM 1
+#define SHARD_GREP 2
+
+struct shard_header {
+  int kind;             // SHARD_*
+  struct shard shard;
+  uint64_t fingerprint; // Of the options that must agree to merge.
+};
+
+// Parse "K/N", where 1 <= K <= N.  Returns non-zero if malformed.
+int shard_parse(const char *arg, struct shard *s);
+
+// Whether piece 'piece' of the file at 'path' belongs to shard 's'.
+// Files that are not cut into pieces are piece 0.
+int shard_owns(const struct shard *s, const char *path, uint64_t piece);
+
+// FNV-1a, for fingerprints.  Start from SHARD_HASH_INIT.
+#define SHARD_HASH_INIT 0xcbf29ce484222325ULL
+uint64_t shard_hash(uint64_t h, const void *data, size_t len);
+
+// Add the options of 'w' that choose which files are scanned (the
+// globs in order, the ignore file, the depth, the sizes and
+// --dedup-content) to 'h'.
+uint64_t shard_hash_walk(uint64_t h, const struct walk *w);
+
+// Create the partial result file 'path', and write its header.
+// Returns NULL and sets errno on failure.
+FILE *shard_create(const char *path, const struct shard_header *h);
+
+// Write a number, a string of bytes, or a double.
+void shard_put(FILE *f, uint64_t v);
+void shard_put_bytes(FILE *f, const void *data, size_t len);
+void shard_put_double(FILE *f, double d);
+
+// Read them back.  Return non-zero at EOF or on error.  Strings are
+// malloc()ed, and NUL-terminated for convenience.
+int shard_get(FILE *f, uint64_t *v);
+int shard_get_bytes(FILE *f, char **data, size_t *len);
+int shard_get_double(FILE *f, double *d);
+
+// The partial results being merged.
+struct shard_merge {
+  struct shard_header header; // Of the first one.
+  unsigned char *seen;        // Which shards have been opened.
+  int count;
+  int allow_partial;          // Whether shards may be missing.
+};
+
+void shard_merge_init(struct shard_merge *m);
+
+// Take the options of 'merge' (only '--allow-partial', and a '--' to
+// end them) off the front of 'args'.  Returns how many there were.
+int shard_merge_args(struct shard_merge *m, int num_args,
+                     char *const *args);
+
+// Open the partial result file 'path', of the given kind, and check
+// that it goes with those opened before.  Exits with an error message
+// if not.  Returns the file, positioned after the header.
+FILE *shard_merge_open(struct shard_merge *m, const char *path, int kind);
+
+// Check that every shard was given, and free 'm'.  Exits with an error
+// message if some are missing, unless 'allow_partial' is set, in which
+// case it only warns that the result is incomplete.
+void shard_merge_end(struct shard_merge *m);
+
+#endif
@@ -0,0 +1,565 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash.h"
+#include "shard.h"
+#include "stats.h"
+
+static void update_hash(struct stats *s, const unsigned char *buf,
+                        size_t len) {
+  uint64_t h = s->file_hash;
+  s->file_len += len;
+
+  // Top up a partial word left over from the previous block.
+  if (s->tail_len > 0) {
+    while (s->tail_len < 8 && len > 0) {
+      s->tail[s->tail_len++] = *buf++;
+      len--;
+    }
+    if (s->tail_len < 8) {
+      s->file_hash = h;
+      return;
+    }
+    h = hash_word(h, load64(s->tail));
+    s->tail_len = 0;
+  }
+
+  for (; len >= 8; buf += 8, len -= 8) {
+    h = hash_word(h, load64(buf));
+  }
+
+  memcpy(s->tail, buf, len);
+  s->tail_len = (int)len;
+  s->file_hash = h;
+}
+
+static void end_hash(struct stats *s) {
+  uint64_t h = s->file_hash;
+
+  if (s->tail_len > 0) {
+    memset(s->tail + s->tail_len, 0, 8 - (size_t)s->tail_len);
+    h = hash_word(h, load64(s->tail));
+  }
+  // Summing the per-file hashes makes the result independent of the
+  // order in which the threads finish the files.
+  s->hash += hash_end(h, s->file_len);
+}
+
+// Counts into four interleaved tables, so that runs of the same byte
+// do not make every increment wait for the previous one.  The 32-bit
+// counters are flushed into the 64-bit totals before they can wrap.
+static void count_bytes(int64_t bytes[256], const unsigned char *buf,
+                        size_t len) {
+  uint32_t c[4][256];
+
+  while (len > 0) {
+    size_t n = len < ((size_t)1 << 30) ? len : ((size_t)1 << 30);
+    size_t i = 0;
+
+    memset(c, 0, sizeof(c));
+    for (; i + 4 <= n; i += 4) {
+      c[0][buf[i]]++;
+      c[1][buf[i + 1]]++;
+      c[2][buf[i + 2]]++;
+      c[3][buf[i + 3]]++;
+    }
+    for (; i < n; i++) {
+      c[0][buf[i]]++;
+    }
+    for (int b = 0; b < 256; b++) {
+      bytes[b] += (int64_t)c[0][b] + c[1][b] + c[2][b] + c[3][b];
+    }
+
+    buf += n;
+    len -= n;
+  }
+}
+
+static void report_bits(FILE *out, const struct stats *s) {
+  int64_t bits[8];
+  stats_bits(s, bits);
+  fprintf(out, "bits:");
+  for (int i = 0; i < 8; i++) {
+    fprintf(out, " %lld", (long long)bits[i]);
+  }
+  fprintf(out, "\n");
+}
+
+static void report_bytes(FILE *out, const struct stats *s) {
+  for (int b = 0; b < 256; b++) {
+    if (s->bytes[b] != 0) {
+      fprintf(out, "byte 0x%02x: %lld\n", b, (long long)s->bytes[b]);
+    }
+  }
+}
+
+static void report_lines(FILE *out, const struct stats *s) {
+  fprintf(out, "lines: %lld\n", (long long)s->bytes['\n']);
+}
+
+static void report_entropy(FILE *out, const struct stats *s) {
+  double h = 0;
+  for (int b = 0; b < 256; b++) {
+    if (s->bytes[b] != 0) {
+      double p = (double)s->bytes[b] / (double)s->total;
+      h -= p * log2(p);
+    }
+  }
+  fprintf(out, "entropy: %.6f bits/byte\n", h);
+}
+
+static void report_hash(FILE *out, const struct stats *s) {
+  fprintf(out, "hash: %016llx\n", (unsigned long long)s->hash);
+}
+
+// A statistic.  Passes with a NULL 'update' are computed from the byte
+// histogram alone.
+struct stats_pass {
+  unsigned flag;
+  const char *name;
+  void (*update)(struct stats *s, const unsigned char *buf, size_t len);
+  void (*end_file)(struct stats *s);
+  void (*report)(FILE *out, const struct stats *s);
+};
+
+static const struct stats_pass passes[] = {
+  {STATS_BITS, "bits", NULL, NULL, report_bits},
+  {STATS_BYTES, "bytes", NULL, NULL, report_bytes},
+  {STATS_LINES, "lines", NULL, NULL, report_lines},
+  {STATS_ENTROPY, "entropy", NULL, NULL, report_entropy},
+  {STATS_HASH, "hash", update_hash, end_hash, report_hash},
+};
+
+#define NUM_PASSES (sizeof(passes) / sizeof(passes[0]))
+
+// The flags of the passes that need the byte histogram.
+static unsigned byte_passes(void) {
+  unsigned flags = 0;
+  for (size_t i = 0; i < NUM_PASSES; i++) {
+    if (passes[i].update == NULL) {
+      flags |= passes[i].flag;
+    }
+  }
+  return flags;
+}
+
+int stats_parse(const char *list, unsigned *which) {
+  *which = 0;
+
+  while (*list != '\0') {
+    size_t len = strcspn(list, ",");
+    size_t i;
+
+    if (len == 3 && strncmp(list, "all", 3) == 0) {
+      for (i = 0; i < NUM_PASSES; i++) {
+        *which |= passes[i].flag;
+      }
+    } else {
+      for (i = 0; i < NUM_PASSES; i++) {
+        if (strlen(passes[i].name) == len &&
+            strncmp(list, passes[i].name, len) == 0) {
+          *which |= passes[i].flag;
+          break;
+        }
+      }
+      if (i == NUM_PASSES) {
+        return 1;
+      }
+    }
+
+    list += len;
+    if (*list == ',') {
+      list++;
+    }
+  }
+
+  return *which == 0;
+}
+
+int stats_parse_args(int argc, char *const *argv, struct stats_args *args,
+                     const char **error) {
+  memset(args, 0, sizeof(struct stats_args));
+  args->num_threads = 1;
+  args->which = STATS_BITS;
+  walk_init(&args->walk);
+
+  int i = 1;
+  while (i < argc && argv[i][0] == '-' && argv[i][1] != '\0') {
+    if (strcmp(argv[i], "--") == 0) {
+      i++;
+      break;
+    }
+    if (strcmp(argv[i], "--follow") == 0) {
+      args->follow = 1;
+      i++;
+      continue;
+    }
+    int taken = walk_parse(&args->walk, argc, argv, i, error);
+    if (taken < 0) {
+      return -1;
+    }
+    if (taken > 0) {
+      i += taken;
+      continue;
+    }
+    if (i + 1 >= argc) {
+      *error = STATS_USAGE;
+      return -1;
+    }
+
+    const char *arg = argv[i + 1];
+    char *end;
+    if (strcmp(argv[i], "-n") == 0) {
+      args->num_threads = atoi(arg);
+      if (args->num_threads < 1) {
+        *error = "invalid thread count";
+        return -1;
+      }
+    } else if (strcmp(argv[i], "-s") == 0) {
+      if (stats_parse(arg, &args->which) != 0) {
+        *error = "unknown statistic";
+        return -1;
+      }
+    } else if (strcmp(argv[i], "--sample") == 0) {
+      args->sample = strtod(arg, &end);
+      if (*end != '\0' || !(args->sample > 0 && args->sample <= 1)) {
+        *error = "the sampling rate must be in (0, 1]";
+        return -1;
+      }
+    } else if (strcmp(argv[i], "--seed") == 0) {
+      args->seed = strtoull(arg, &end, 0);
+      if (*end != '\0' || end == arg) {
+        *error = "invalid seed";
+        return -1;
+      }
+      args->seeded = 1;
+    } else if (strcmp(argv[i], "--io") == 0) {
+      if (input_parse_io(arg, &args->io) != 0) {
+        *error = "unknown I/O strategy (use " INPUT_IO_NAMES ")";
+        return -1;
+      }
+    } else if (strcmp(argv[i], "--shard") == 0) {
+      if (shard_parse(arg, &args->shard) != 0) {
+        *error = "invalid shard (use K/N, with 1 <= K <= N)";
+        return -1;
+      }
+    } else if (strcmp(argv[i], "--partial") == 0) {
+      args->partial = arg;
+    } else {
+      *error = STATS_USAGE;
+      return -1;
+    }
+    i += 2;
+  }
+
+  if (i >= argc || (args->follow && args->sample > 0)) {
+    *error = STATS_USAGE;
+    return -1;
+  }
+  return i;
+}
+
+void stats_init(struct stats *s, unsigned which) {
+  memset(s, 0, sizeof(struct stats));
+  s->which = which;
+}
+
+void stats_begin_file(struct stats *s) {
+  s->file_hash = 0;
+  s->file_len = 0;
+  s->tail_len = 0;
+}
+
+void stats_end_file(struct stats *s) {
+  for (size_t i = 0; i < NUM_PASSES; i++) {
+    if ((s->which & passes[i].flag) && passes[i].end_file != NULL) {
+      passes[i].end_file(s);
+    }
+  }
+}
+
+void stats_update(struct stats *s, const unsigned char *buf, size_t len) {
+  s->total += (int64_t)len;
+
+  if (s->which & byte_passes()) {
+    count_bytes(s->bytes, buf, len);
+  }
+  for (size_t i = 0; i < NUM_PASSES; i++) {
+    if ((s->which & passes[i].flag) && passes[i].update != NULL) {
+      passes[i].update(s, buf, len);
+    }
+  }
+}
+
+void stats_merge(struct stats *from, struct stats *to) {
+  to->total += from->total;
+  from->total = 0;
+  for (int b = 0; b < 256; b++) {
+    to->bytes[b] += from->bytes[b];
+    from->bytes[b] = 0;
+  }
+  to->hash += from->hash;
+  from->hash = 0;
+  for (int i = 0; i < 8; i++) {
+    to->var_bb[i] += from->var_bb[i];
+    to->var_bn[i] += from->var_bn[i];
+    from->var_bb[i] = 0;
+    from->var_bn[i] = 0;
+  }
+  to->var_nn += from->var_nn;
+  from->var_nn = 0;
+  to->sampled += from->sampled;
+  from->sampled = 0;
+}
+
+// Counts are never negative, so they are saved as varints; only the
+// byte histogram is long, and mostly small numbers.
+void stats_save(FILE *out, const struct stats *s) {
+  shard_put(out, s->which);
+  shard_put(out, (uint64_t)s->total);
+  for (int b = 0; b < 256; b++) {
+    shard_put(out, (uint64_t)s->bytes[b]);
+  }
+  shard_put(out, s->hash);
+  for (int i = 0; i < 8; i++) {
+    shard_put_double(out, s->var_bb[i]);
+    shard_put_double(out, s->var_bn[i]);
+  }
+  shard_put_double(out, s->var_nn);
+  shard_put(out, (uint64_t)s->sampled);
+}
+
+int stats_load(FILE *in, struct stats *s) {
+  uint64_t which, v;
+  if (shard_get(in, &which) != 0 || which > UINT32_MAX) {
+    return -1;
+  }
+  stats_init(s, (unsigned)which);
+  if (shard_get(in, &v) != 0) {
+    return -1;
+  }
+  s->total = (int64_t)v;
+  for (int b = 0; b < 256; b++) {
+    if (shard_get(in, &v) != 0) {
+      return -1;
+    }
+    s->bytes[b] = (int64_t)v;
+  }
+  if (shard_get(in, &s->hash) != 0) {
+    return -1;
+  }
+  for (int i = 0; i < 8; i++) {
+    if (shard_get_double(in, &s->var_bb[i]) != 0 ||
+        shard_get_double(in, &s->var_bn[i]) != 0) {
+      return -1;
+    }
+  }
+  if (shard_get_double(in, &s->var_nn) != 0) {
+    return -1;
+  }
+  if (shard_get(in, &v) != 0) {
+    return -1;
+  }
+  s->sampled = (int64_t)v;
+  return 0;
+}
+
+// Adds 'c' times the products of the bit counts and the byte count
+// in 't' (of a unit, or the difference between two strata) to the
+// variance sums of 'to'.
+static void add_variance(struct stats *to, const double t[9], double c) {
+  double n = t[8];
+  for (int i = 0; i < 8; i++) {
+    to->var_bb[i] += c * t[i] * t[i];
+    to->var_bn[i] += c * t[i] * n;
+  }
+  to->var_nn += c * n * n;
+}
+
+// The bit counts and byte count of 'from', times 'weight'.
+static void unit_totals(const struct stats *from, int64_t weight,
+                        double t[9]) {
+  int64_t bits[8];
+  stats_bits(from, bits);
+  for (int i = 0; i < 8; i++) {
+    t[i] = (double)weight * (double)bits[i];
+  }
+  t[8] = (double)weight * (double)from->total;
+}
+
+// Adds the Horvitz-Thompson estimate of 'from' to 'to': every unit
+// read stands for 'weight' units.
+static void add_estimate(struct stats *from, struct stats *to,
+                         int64_t weight) {
+  to->sampled += from->total;
+  to->total += weight * from->total;
+  from->total = 0;
+  for (int b = 0; b < 256; b++) {
+    to->bytes[b] += weight * from->bytes[b];
+    from->bytes[b] = 0;
+  }
+}
+
+void stats_add_sample(struct stats *from, struct stats *to, int64_t weight) {
+  // Every unit picked independently with chance p = 1 / weight: the
+  // variance of a total is estimated by summing (1 - p) / p^2 * y^2
+  // over the units read.
+  double t[9];
+  unit_totals(from, 1, t);
+  add_variance(to, t, (double)weight * (double)weight - (double)weight);
+  add_estimate(from, to, weight);
+}
+
+// With one unit picked out of each stratum of 'weight', no stratum
+// says anything about the variance on its own.  Collapsing adjacent
+// strata in pairs, each pair contributes (1 - 1/weight) (t1 - t2)^2,
+// where t1 and t2 are the estimated totals of the two strata; that
+// overestimates the variance only by the real differences between
+// the strata.  With 'weight' 1, every unit is read, and there is no
+// variance at all.
+static void add_pair(struct stats *to, const double t1[9],
+                     const double t2[9], int64_t weight) {
+  double d[9];
+  for (int i = 0; i < 9; i++) {
+    d[i] = t1[i] - t2[i];
+  }
+  add_variance(to, d, 1 - 1 / (double)weight);
+}
+
+void stats_add_stratum(struct stats *from, struct stats *to, int64_t weight) {
+  double t[9];
+  unit_totals(from, weight, t);
+  if (from->strata_pending) {
+    add_pair(to, from->pending, t, weight);
+    memcpy(from->last, t, sizeof(t));
+    from->strata_pending = 0;
+    from->strata_paired = 1;
+  } else {
+    memcpy(from->pending, t, sizeof(t));
+    from->strata_pending = 1;
+  }
+  add_estimate(from, to, weight);
+}
+
+void stats_end_strata(struct stats *from, struct stats *to, int64_t weight) {
+  if (!from->strata_pending) {
+    return;
+  }
+  // An odd stratum out is compared with the last one paired, or, if
+  // it is the only one, with nothing at all.
+  double zero[9] = {0};
+  add_pair(to, from->pending, from->strata_paired ? from->last : zero,
+           weight);
+  from->strata_pending = 0;
+}
+
+void stats_bits_margin(const struct stats *s, double margin[8]) {
+  int64_t bits[8];
+  stats_bits(s, bits);
+  double n = (double)s->total;
+
+  // The frequency r = b / n is a ratio of estimates.  Linearised, its
+  // variance is that of the total of b - r n, divided by n^2.
+  for (int i = 0; i < 8; i++) {
+    margin[i] = 0;
+    if (n > 0) {
+      double r = (double)bits[i] / n;
+      double v = s->var_bb[i] - 2 * r * s->var_bn[i] + r * r * s->var_nn;
+      margin[i] = v > 0 ? 1.96 * sqrt(v) / n : 0;
+    }
+  }
+}
+
+void stats_bits(const struct stats *s, int64_t bits[8]) {
+  for (int i = 0; i < 8; i++) {
+    bits[i] = 0;
+  }
+  for (int b = 0; b < 256; b++) {
+    for (int i = 0; i < 8; i++) {
+      if (b & (1 << i)) {
+        bits[i] += s->bytes[b];
+      }
+    }
+  }
+}
+
+void stats_report(FILE *out, const struct stats *s) {
+  fprintf(out, "total: %lld bytes\n", (long long)s->total);
+  if (s->sampled > 0) {
+    fprintf(out, "sampled: %lld bytes (all counts are estimates)\n",
+            (long long)s->sampled);
+  }
+  for (size_t i = 0; i < NUM_PASSES; i++) {
+    if (s->which & passes[i].flag) {
+      passes[i].report(out, s);
+    }
+  }
+}
+
+void stats_move_lines(int n) {
+  if (n < 0) {
+    printf("\033[%dA", -n);
+  } else {
+    printf("\033[%dB", n);
+  }
+}
+
+// Clear from cursor to end of line.
+static void clear_line(void) { printf("\033[K"); }
+
+void stats_print_bits(const int64_t bits[8]) {
+  int64_t bits_seen = 0;
+
+  for (int i = 0; i < 8; i++) {
+    bits_seen += bits[i];
+  }
+
+  for (int i = 0; i < 8; i++) {
+    clear_line();
+    printf("Bit %d: ", i);
+
+    double proportion = bits[i] / ((double)bits_seen);
+    for (int j = 0; j < 60 * proportion; j++) {
+      printf("*");
+    }
+    printf("\n");
+  }
+
+  clear_line();
+  printf("%lld bits processed.\n", (long long)bits_seen);
+  stats_move_lines(-9);
+}
+
+void stats_print_bits_ci(const struct stats *s) {
+  int64_t bits[8];
+  double margin[8];
+  stats_bits(s, bits);
+  stats_bits_margin(s, margin);
+
+  int64_t bits_seen = 0;
+
+  for (int i = 0; i < 8; i++) {
+    bits_seen += bits[i];
+  }
+
+  for (int i = 0; i < 8; i++) {
+    clear_line();
+    printf("Bit %d: ", i);
+
+    double proportion = bits[i] / ((double)bits_seen);
+    int stars = 0;
+    for (; stars < 60 * proportion; stars++) {
+      printf("*");
+    }
+    double frequency = s->total > 0 ? bits[i] / (double)s->total : 0;
+    printf("%*s %7.3f%% +/- %.3f%%\n", 61 - stars, "", 100 * frequency,
+           100 * margin[i]);
+  }
+
+  clear_line();
+  printf("~%lld bits processed (estimated).\n", (long long)bits_seen);
+  stats_move_lines(-9);
+}
@@ -0,0 +1,163 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "input.h"
+#include "shard.h"
+#include "walk.h"
+
+// Single-pass statistics over file contents.  Every block read is
+// handed to stats_update() once, which feeds it to all the requested
+// statistics, so the data is read once no matter how many are wanted.
+//
+// Each thread accumulates into its own 'struct stats', which is
+// merged into a shared one from time to time with stats_merge().
+//
+// Statistics are added by adding a row to the table of passes in
+// stats.c.  Passes either look at the data themselves, or are
+// computed from the 256-bin byte histogram, which is then counted
+// once on their behalf.
+
+#define STATS_BITS (1u << 0)    // How often each of the 8 bits is set.
+#define STATS_BYTES (1u << 1)   // How often each byte value occurs.
+#define STATS_LINES (1u << 2)   // Number of newlines.
+#define STATS_ENTROPY (1u << 3) // Shannon entropy, in bits per byte.
+#define STATS_HASH (1u << 4)    // Content hash, independent of file order.
+
+#define STATS_USAGE                                                      \
+  "usage: [-n INT] [-s bits,bytes,lines,entropy,hash|all] "              \
+  "[--follow | --sample RATE [--seed INT]] [--io " INPUT_IO_NAMES "] "   \
+  WALK_USAGE " " SHARD_USAGE " paths..."
+
+struct stats {
+  unsigned which;     // STATS_* flags.
+  int64_t total;      // Bytes seen.
+  int64_t bytes[256]; // Byte histogram, if any statistic needs it.
+  uint64_t hash;      // Sum of the hashes of all finished files.
+
+  // When the counts are estimates from a sample (see
+  // stats_add_sample()): the bytes actually read, and the sums from
+  // which stats_bits_margin() estimates the variance of the bit
+  // frequencies.  For each unit (or pair of strata), 'b' is its bit
+  // count, and 'n' its byte count: var_bb sums b*b, var_bn b*n, and
+  // var_nn n*n, each times its weight in the variance.
+  int64_t sampled;
+  double var_bb[8];
+  double var_bn[8];
+  double var_nn;
+
+  // Stratified samples (see stats_add_stratum()): the estimated bit
+  // and byte counts of the stratum waiting to be paired with the next
+  // one, and of the last one paired.  Not touched by stats_merge().
+  int strata_pending;
+  int strata_paired;
+  double pending[9];
+  double last[9];
+
+  // State of the file currently being hashed.  Not touched by
+  // stats_merge().
+  uint64_t file_hash;
+  uint64_t file_len;
+  unsigned char tail[8];
+  int tail_len;
+};
+
+// Parse a comma-separated list of statistic names (or "all") into
+// STATS_* flags.  Returns non-zero if a name is unknown.
+int stats_parse(const char *list, unsigned *which);
+
+// The options of an fhistogram-mt command line.
+struct stats_args {
+  int num_threads; // -n
+  unsigned which;  // -s
+  int follow;      // --follow
+  double sample;   // --sample: the fraction of blocks to read, or 0.
+  uint64_t seed;   // --seed
+  int seeded;      // Whether --seed was given.
+  enum input_io io; // --io
+  struct shard shard;  // --shard: which files are ours; see shard.h.
+  const char *partial; // --partial: where to save the totals, or NULL.
+  struct walk walk; // Which files to read; see walk.h.  Freed by the
+                    // caller with walk_free(), even on error.
+};
+
+// Parse an fhistogram-mt command line ('argv[0]' is the program name),
+// with options in any order.  Safe to call from several threads at
+// once.  Returns the index of the first path, or -1 on error, in which
+// case '*error' says why.
+int stats_parse_args(int argc, char *const *argv, struct stats_args *args,
+                     const char **error);
+
+void stats_init(struct stats *s, unsigned which);
+
+// Bracket the blocks of each file with these.
+void stats_begin_file(struct stats *s);
+void stats_end_file(struct stats *s);
+
+// Account for the next 'len' bytes of the current file.
+void stats_update(struct stats *s, const unsigned char *buf, size_t len);
+
+// Add the totals of 'from' to 'to', setting those of 'from' to zero
+// in the process.  The file in progress in 'from' stays there.
+void stats_merge(struct stats *from, struct stats *to);
+
+// Save the totals of 's' to a partial result (see shard.h), or load
+// them back into 's', which is initialised.  stats_load() returns
+// non-zero if the data is cut short.  Combine loaded totals with
+// stats_merge().
+void stats_save(FILE *out, const struct stats *s);
+int stats_load(FILE *in, struct stats *s);
+
+// Add 'from', the statistics of one unit (a whole file, say) of a
+// sample in which every unit had a chance of 1/'weight' to be picked,
+// independently of the others, to the estimates in 'to'.  The totals
+// of 'from' are set to zero.
+void stats_add_sample(struct stats *from, struct stats *to, int64_t weight);
+
+// Like stats_add_sample(), for a stratified sample: the units are cut
+// into strata of 'weight' units, and exactly one is picked in each.
+// 'from' holds what was read of the one picked, which is nothing if
+// it lay past the end of the data.  Every stratum must be added,
+// in order, and then stats_end_strata() called.  The variance is
+// estimated from the differences between adjacent strata, taken in
+// pairs, which 'from' keeps track of.  A single stratum is compared
+// with an empty one, which makes its variance that of a unit picked
+// with a chance of 1/'weight', as in stats_add_sample().
+void stats_add_stratum(struct stats *from, struct stats *to, int64_t weight);
+
+// Account for a stratum added to 'from' but not yet paired, comparing
+// it with the one before.
+void stats_end_strata(struct stats *from, struct stats *to, int64_t weight);
+
+// The half-widths of the 95% confidence intervals of the estimated
+// frequencies of the bits (the share of bytes in which each is set),
+// treating each as the ratio of two estimated totals.  Zero if every
+// unit was read.
+void stats_bits_margin(const struct stats *s, double margin[8]);
+
+// The bit histogram, as shown by stats_print_bits().  Only valid if
+// STATS_BITS was requested.
+void stats_bits(const struct stats *s, int64_t bits[8]);
+
+// Print the total and every requested statistic as "name: value"
+// lines.
+void stats_report(FILE *out, const struct stats *s);
+
+// Drawing the bit histogram on the terminal, in the manner of
+// histogram.h, but for 64-bit counts.
+
+// Move the cursor down 'n' lines.  Negative 'n' supported.
+void stats_move_lines(int n);
+
+// Draw the bit histogram 'bits' on standard output.  The cursor is
+// moved back to the beginning of the drawing, so the next one
+// overwrites it.
+void stats_print_bits(const int64_t bits[8]);
+
+// Like stats_print_bits(), for the estimates in 's', with the
+// frequency of every bit and its 95% confidence interval.
+void stats_print_bits_ci(const struct stats *s);
+
+#endif
@@ -0,0 +1,348 @@
+#!/bin/sh
+#
+# Golden-output checks of fauxgrep-mt, fhistogram-mt and scan-daemon on
+# small fixture trees, built afresh in a temporary directory.  Run by
+# 'make test' from this directory, after everything is built.  Prints
+# a line per check, and the difference for those that fail.
+
+set -u
+
+bin=$(pwd)
+tmp=$(mktemp -d)
+daemon=
+trap 'test -n "$daemon" && kill $daemon; rm -rf "$tmp"' EXIT
+cd "$tmp" || exit 1
+failures=0
+
+# check NAME: compare the file 'got' with standard input.
+check() {
+  if diff -u - got > diff.out; then
+    echo "ok   $1"
+  else
+    echo "FAIL $1"
+    cat diff.out
+    failures=$((failures + 1))
+  fi
+}
+
+grep_mt() { "$bin/fauxgrep-mt" "$@"; }
+histogram_mt() { "$bin/fhistogram-mt" "$@"; }
+
+#
+# Binary files and -i.
+#
+
+mkdir b
+printf 'int one\000\nint two\n' > b/data.bin
+printf 'Int Two\n' > b/text.txt
+
+for opt in "" -I -a; do
+  echo "[$opt]"
+  grep_mt -n 1 $opt two b | sort
+done > got
+check "-I and -a" <<EOF
+[]
+Binary file b/data.bin matches
+[-I]
+[-a]
+b/data.bin:2:int two
+EOF
+
+grep_mt -n 1 -i -I 'int TWO' b > got
+check "-i" <<EOF
+b/text.txt:1:Int Two
+EOF
+
+#
+# -l, -m and -q, which stop reading a file once they have their answer.
+#
+
+mkdir q
+seq 1 5000 | sed 's/^/line /' | gzip -c > q/full.gz
+# The first lines are intact; reading on fails.
+head -c 3000 q/full.gz > cut.gz
+
+grep_mt -q -E '^line 1$' cut.gz > got 2>&1
+echo "exit $?" >> got
+grep_mt -q nothing q/full.gz >> got 2>&1
+echo "exit $?" >> got
+grep_mt -l -E '^line 1$' cut.gz >> got 2>&1
+echo "exit $?" >> got
+grep_mt -m 2 -E '^line 1' cut.gz >> got 2>&1
+echo "exit $?" >> got
+check "-q, -l and -m" <<EOF
+exit 0
+exit 1
+cut.gz
+exit 0
+cut.gz:1:line 1
+cut.gz:10:line 10
+exit 0
+EOF
+
+#
+# Compressed input.
+#
+
+mkdir z
+seq 1 5000 | sed 's/^/line /' > z/plain.txt
+gzip -c z/plain.txt > z/plain.txt.gz
+# Several members, as pigz and 'cat a.gz b.gz' make them.
+head -n 2500 z/plain.txt | gzip -c > z/multi.txt.gz
+tail -n 2500 z/plain.txt | gzip -c >> z/multi.txt.gz
+
+for f in z/plain.txt z/plain.txt.gz z/multi.txt.gz; do
+  grep_mt -n 4 -E '^line (1|4321)$' "$f"
+done | sort > got
+check "gzip search" <<EOF
+z/multi.txt.gz:1:line 1
+z/multi.txt.gz:4321:line 4321
+z/plain.txt.gz:1:line 1
+z/plain.txt.gz:4321:line 4321
+z/plain.txt:1:line 1
+z/plain.txt:4321:line 4321
+EOF
+
+histogram_mt -s bytes,lines,entropy,hash z/plain.txt | grep -v Queued > single
+for f in z/plain.txt.gz z/multi.txt.gz; do
+  histogram_mt -n 4 -s bytes,lines,entropy,hash "$f" | grep -v Queued > got
+  check "gzip statistics ($f)" < single
+done
+
+grep_mt -n 1 nothing cut.gz > got 2>&1
+echo "exit $?" >> got
+check "truncated gzip" <<EOF
+fauxgrep-mt: failed to read cut.gz: Input/output error
+exit 2
+EOF
+
+#
+# --follow.  -q makes it stop at the first match, so a line appended
+# to a file, or a file that appears in a new directory, ends the run.
+#
+
+mkdir f
+echo 'nothing yet' > f/log
+for what in appended created; do
+  grep_mt --follow -q "$what" f &
+  follower=$!
+  sleep 0.5
+  if [ $what = appended ]; then
+    echo 'line appended' >> f/log
+  else
+    mkdir f/new
+    echo 'file created' > f/new/log
+  fi
+  # Never wait for ever.
+  ( sleep 10; kill $follower 2>/dev/null ) &
+  watchdog=$!
+  wait $follower
+  echo "$what: exit $?"
+  kill $watchdog 2>/dev/null
+done > got
+check "--follow" <<EOF
+appended: exit 0
+created: exit 0
+EOF
+
+#
+# --sample.
+#
+
+# The last redraw of the histogram is followed by one line of totals.
+histogram_mt --sample 1 --seed 7 z | tail -n 10 | grep -c '+/- 0.000%$' > got
+check "--sample 1 is exact" <<EOF
+8
+EOF
+
+#
+# --io: every way of reading gives the same results.
+#
+
+# unqueue FILE: fhistogram-mt output without its "Queued file:" lines,
+# which come in between the redraws wherever timing puts them.
+unqueue() { sed 's/Queued file: .*//' "$1" | tr -d '\n'; echo; }
+
+grep_mt -n 4 -E '^line (1|4321)$' z | sort > single
+histogram_mt -n 1 -s all z/plain.txt > single.hist
+unqueue single.hist > expected
+for io in fadvise direct; do
+  grep_mt -n 4 --io $io -E '^line (1|4321)$' z | sort > got
+  check "--io $io search" < single
+  histogram_mt -n 1 --io $io -s all z/plain.txt > read
+  unqueue read > got
+  check "--io $io statistics" < expected
+done
+
+#
+# The walk: globs, ignore files and --max-depth.
+#
+
+mkdir -p t/d/sub/deeper
+echo 'int top;' > t/top.c
+echo 'int top_h;' > t/top.h
+echo 'int notes' > t/notes.txt
+echo 'int one;' > t/d/one.c
+echo 'int obj' > t/d/skip.o
+echo 'int two;' > t/d/sub/two.c
+echo 'int three;' > t/d/sub/deeper/three.c
+printf 'sub/deeper/\n*.o\n' > t/d/.scanignore
+
+grep_mt -l --include '*.c' int t | sort > got
+check "--include" <<EOF
+t/d/one.c
+t/d/sub/deeper/three.c
+t/d/sub/two.c
+t/top.c
+EOF
+
+grep_mt -l --exclude sub --exclude '*.h' int t | sort > got
+check "--exclude" <<EOF
+t/d/one.c
+t/d/skip.o
+t/notes.txt
+t/top.c
+EOF
+
+grep_mt -l --ignore-file .scanignore int t | sort > got
+check "--ignore-file" <<EOF
+t/d/one.c
+t/d/sub/two.c
+t/notes.txt
+t/top.c
+t/top.h
+EOF
+
+for depth in 0 1 2; do
+  grep_mt -l --max-depth $depth --include '*.c' int t | sort > "depth$depth"
+done
+cp depth0 got
+check "--max-depth 0" <<EOF
+t/top.c
+EOF
+cp depth1 got
+check "--max-depth 1" <<EOF
+t/d/one.c
+t/top.c
+EOF
+cp depth2 got
+check "--max-depth 2" <<EOF
+t/d/one.c
+t/d/sub/two.c
+t/top.c
+EOF
+
+# Directories that appear under --follow are pruned as the initial
+# walk prunes them, with globs that have a '/' matched below the root.
+mkdir w
+echo 'nothing yet' > w/log
+# Not through grep_mt(), so that $! is the process to kill.
+"$bin/fauxgrep-mt" --follow --exclude skip --exclude '/top/*.txt' int w \
+  > got &
+follower=$!
+sleep 0.5
+mkdir -p w/skip w/top w/new/top
+echo 'int skipped' > w/skip/a.c
+echo 'int anchored' > w/top/a.txt
+echo 'int kept' > w/new/top/a.txt
+echo 'int kept too' > w/top/b.c
+sleep 1
+kill $follower
+wait $follower 2>/dev/null
+sort got > sorted
+mv sorted got
+check "--follow with --exclude" <<EOF
+w/new/top/a.txt:1:int kept
+w/top/b.c:1:int kept too
+EOF
+
+#
+# --dedup-content.
+#
+
+mkdir dup
+echo 'same words' > dup/a.txt
+echo 'same words' > dup/b.txt
+echo 'some words' > dup/c.txt
+
+grep_mt -l --dedup-content words dup | sed 's/[ab]\.txt/X.txt/' | sort > got
+check "--dedup-content" <<EOF
+dup/X.txt
+dup/c.txt
+EOF
+
+#
+# Sharded runs merge into what a single run prints.
+#
+
+# Twenty files, for the shards to split between them.
+mkdir -p many/a many/b
+for i in $(seq 1 20); do
+  seq "$i" 3 200 | sed "s/^/row /" > "many/$((i % 2 == 0 ? 2 : 1))$i.txt"
+done
+mv many/1*.txt many/a/
+mv many/2*.txt many/b/
+
+grep_mt -n 4 -E 'row (1|2)7$' many | sort > single
+for k in 1 2 3; do
+  grep_mt --shard $k/3 --partial grep$k.part -E 'row (1|2)7$' many
+done
+grep_mt merge grep1.part grep2.part grep3.part | sort > got
+check "grep merge" < single
+
+histogram_mt -n 4 -s all many > single
+for k in 1 2 3; do
+  histogram_mt --shard $k/3 --partial hist$k.part -s all many > /dev/null
+done
+histogram_mt merge hist1.part hist2.part hist3.part > merged
+# What a single run shows once it is done, its last redraw of the
+# histogram onwards.
+tail -c "$(wc -c < merged)" single > got
+check "histogram merge" < merged
+
+grep_mt merge grep1.part grep3.part > /dev/null 2>&1
+echo "exit $?" > got
+histogram_mt merge --allow-partial hist1.part hist3.part > /dev/null 2>&1
+echo "exit $?" >> got
+check "merge of some of the shards" <<EOF
+exit 1
+exit 0
+EOF
+
+# Shards that scanned differently chosen files cannot be merged.
+grep_mt --shard 1/2 --partial excl1.part -E 'row (1|2)7$' many
+grep_mt --shard 2/2 --partial excl2.part --exclude b -E 'row (1|2)7$' many
+grep_mt merge excl1.part excl2.part > /dev/null 2>&1
+echo "exit $?" > got
+check "merge of shards with another --exclude" <<EOF
+exit 1
+EOF
+
+#
+# scan-daemon answers as a local run would.
+#
+
+"$bin/scan-daemon" -n 2 "$tmp/sock" &
+daemon=$!
+for i in 1 2 3 4 5 6 7 8 9 10; do
+  test -S sock && break
+  sleep 0.1
+done
+
+histogram_mt -n 1 -s all z/plain.txt > single
+SCAND_SOCKET="$tmp/sock" histogram_mt -n 1 -s all z/plain.txt > forwarded
+{ unqueue single; echo 1; } > expected
+{ unqueue forwarded; grep -c 'Queued file: z/plain' forwarded; } > got
+check "scan-daemon histogram" < expected
+
+SCAND_SOCKET="$tmp/sock" grep_mt nothing cut.gz > got 2>&1
+echo "exit $?" >> got
+check "scan-daemon read error" <<EOF
+scan-daemon: failed to read cut.gz: Input/output error
+exit 2
+EOF
+
+if [ $failures -gt 0 ]; then
+  echo "$failures checks failed"
+  exit 1
+fi
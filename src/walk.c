@@ -0,0 +1,515 @@
+// Setting _DEFAULT_SOURCE is necessary to activate visibility of
+// certain header file contents on GNU/Linux systems.
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fts.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+// err.h contains various nonstandard BSD extensions, but they are
+// very handy.
+#include <err.h>
+
+#include "walk.h"
+
+// How a glob is matched.  Most are plain names ('.git') or extensions
+// ('*.o'), which are compared directly; only the rest go through
+// match().
+#define GLOB_LITERAL 0 // No wildcards at all.
+#define GLOB_SUFFIX 1  // '*' followed by a literal.
+#define GLOB_ANY 2
+
+void walk_init(struct walk *w) {
+  memset(w, 0, sizeof(struct walk));
+  w->max_depth = -1;
+  w->max_size = -1;
+  dedup_init(&w->seen);
+}
+
+// Match the character 'c' against the bracket expression at 'p'.
+// Returns whether it matched, with '*end' set past the expression, or
+// -1 if there is no closing ']'.
+static int bracket(const char *p, unsigned char c, const char **end) {
+  int negate = 0;
+  int found = 0;
+
+  p++;
+  if (*p == '!' || *p == '^') {
+    negate = 1;
+    p++;
+  }
+
+  // A ']' right at the start is an ordinary character.
+  const char *start = p;
+  while (*p != '\0' && (*p != ']' || p == start)) {
+    unsigned char lo = (unsigned char)*p;
+    if (lo == '\\' && p[1] != '\0')
+      lo = (unsigned char)*++p;
+    p++;
+
+    unsigned char hi = lo;
+    if (p[0] == '-' && p[1] != ']' && p[1] != '\0') {
+      p++;
+      if (*p == '\\' && p[1] != '\0')
+        p++;
+      hi = (unsigned char)*p++;
+    }
+    if (lo <= c && c <= hi)
+      found = 1;
+  }
+
+  if (*p != ']')
+    return -1;
+  *end = p + 1;
+  return found != negate;
+}
+
+static int match(const char *p, const char *s) {
+  for (;;) {
+    switch (*p) {
+    case '\0':
+      return *s == '\0';
+
+    case '*':
+      if (p[1] == '*') {
+        p += 2;
+        if (*p == '/') {
+          // 'a/**/b' matches 'a/b' as well.
+          p++;
+          if (match(p, s))
+            return 1;
+          for (; *s != '\0'; s++) {
+            if (*s == '/' && match(p, s + 1))
+              return 1;
+          }
+          return 0;
+        }
+        for (;; s++) {
+          if (match(p, s))
+            return 1;
+          if (*s == '\0')
+            return 0;
+        }
+      }
+
+      p++;
+      for (;; s++) {
+        if (match(p, s))
+          return 1;
+        if (*s == '\0' || *s == '/')
+          return 0;
+      }
+
+    case '?':
+      if (*s == '\0' || *s == '/')
+        return 0;
+      p++;
+      s++;
+      break;
+
+    case '[': {
+      if (*s == '\0' || *s == '/')
+        return 0;
+      const char *end;
+      int in = bracket(p, (unsigned char)*s, &end);
+      if (in < 0) {
+        // Unterminated, so just a '['.
+        if (*s != '[')
+          return 0;
+        end = p + 1;
+      } else if (!in) {
+        return 0;
+      }
+      p = end;
+      s++;
+      break;
+    }
+
+    case '\\':
+      if (p[1] != '\0')
+        p++;
+      // Fall through.
+    default:
+      if (*p != *s)
+        return 0;
+      p++;
+      s++;
+      break;
+    }
+  }
+}
+
+static int glob_matches(const struct walk_glob *g, const char *name,
+                        const char *rel) {
+  const char *s = g->anchored ? rel : name;
+
+  switch (g->kind) {
+  case GLOB_LITERAL:
+    return strcmp(g->pattern, s) == 0;
+  case GLOB_SUFFIX: {
+    size_t n = strlen(s);
+    return n >= g->len - 1 &&
+           memcmp(s + n - (g->len - 1), g->pattern + 1, g->len - 1) == 0;
+  }
+  default:
+    return match(g->pattern, s);
+  }
+}
+
+// Add 'text' to 'r'.  Negation and directory-only rules are only
+// recognised in ignore files ('ignore_syntax' set).
+static int add_glob(struct walk_rules *r, const char *text,
+                    int ignore_syntax) {
+  struct walk_glob g;
+  memset(&g, 0, sizeof(g));
+
+  if (ignore_syntax && *text == '!') {
+    g.negate = 1;
+    text++;
+  }
+  g.pattern = strdup(text);
+  if (g.pattern == NULL)
+    return -1;
+  g.len = strlen(g.pattern);
+
+  if (ignore_syntax && g.len > 1 && g.pattern[g.len - 1] == '/') {
+    g.dir_only = 1;
+    g.pattern[--g.len] = '\0';
+  }
+  // A '/' anywhere but at the end ties the glob to the base directory.
+  if (strchr(g.pattern, '/') != NULL) {
+    g.anchored = 1;
+    if (g.pattern[0] == '/')
+      memmove(g.pattern, g.pattern + 1, g.len--);
+  }
+
+  if (strpbrk(g.pattern, "*?[\\") == NULL)
+    g.kind = GLOB_LITERAL;
+  else if (g.pattern[0] == '*' && !g.anchored &&
+           strpbrk(g.pattern + 1, "*?[\\") == NULL)
+    g.kind = GLOB_SUFFIX;
+  else
+    g.kind = GLOB_ANY;
+
+  if (r->num == r->cap) {
+    int cap = r->cap ? 2 * r->cap : 8;
+    struct walk_glob *bigger =
+        realloc(r->globs, (size_t)cap * sizeof(struct walk_glob));
+    if (bigger == NULL) {
+      free(g.pattern);
+      return -1;
+    }
+    r->globs = bigger;
+    r->cap = cap;
+  }
+  r->globs[r->num++] = g;
+  return 0;
+}
+
+// Returns 1 if the last rule of 'r' to match says to leave the entry
+// out, -1 if it says to keep it, and 0 if none matches.
+static int rules_match(const struct walk_rules *r, const char *name,
+                       const char *rel, int is_dir) {
+  for (int i = r->num - 1; i >= 0; i--) {
+    const struct walk_glob *g = &r->globs[i];
+    if (g->dir_only && !is_dir)
+      continue;
+    if (glob_matches(g, name, rel))
+      return g->negate ? -1 : 1;
+  }
+  return 0;
+}
+
+static void free_rules(struct walk_rules *r) {
+  for (int i = 0; i < r->num; i++)
+    free(r->globs[i].pattern);
+  free(r->globs);
+  memset(r, 0, sizeof(struct walk_rules));
+}
+
+// Suffixes: k, M, G.
+static int parse_size(const char *arg, off_t *size) {
+  char *end;
+  long long n = strtoll(arg, &end, 10);
+  if (end == arg || n < 0)
+    return -1;
+
+  switch (*end) {
+  case 'k':
+  case 'K':
+    n <<= 10;
+    end++;
+    break;
+  case 'M':
+    n <<= 20;
+    end++;
+    break;
+  case 'G':
+    n <<= 30;
+    end++;
+    break;
+  }
+  if (*end != '\0')
+    return -1;
+  *size = (off_t)n;
+  return 0;
+}
+
+int walk_parse(struct walk *w, int argc, char *const *argv, int i,
+               const char **error) {
+  static const char *const options[] = {
+    "--include", "--exclude", "--ignore-file",
+    "--max-depth", "--min-size", "--max-size",
+  };
+  const int num_options = sizeof(options) / sizeof(options[0]);
+
+  if (strcmp(argv[i], "--dedup-content") == 0) {
+    w->dedup_content = 1;
+    return 1;
+  }
+
+  int k = 0;
+  while (k < num_options && strcmp(argv[i], options[k]) != 0)
+    k++;
+  if (k == num_options)
+    return 0;
+
+  if (i + 1 >= argc) {
+    *error = "usage: " WALK_USAGE;
+    return -1;
+  }
+  const char *arg = argv[i + 1];
+  char *end;
+
+  switch (k) {
+  case 0:
+  case 1:
+    if (add_glob(k == 0 ? &w->include : &w->exclude, arg, 0) != 0) {
+      *error = "out of memory";
+      return -1;
+    }
+    break;
+  case 2:
+    if (*arg == '\0' || strchr(arg, '/') != NULL) {
+      *error = "the ignore file must be given by name only";
+      return -1;
+    }
+    free(w->ignore_file);
+    w->ignore_file = strdup(arg);
+    if (w->ignore_file == NULL) {
+      *error = "out of memory";
+      return -1;
+    }
+    break;
+  case 3:
+    w->max_depth = (int)strtol(arg, &end, 10);
+    if (end == arg || *end != '\0' || w->max_depth < 0) {
+      *error = "invalid depth";
+      return -1;
+    }
+    break;
+  default:
+    if (parse_size(arg, k == 4 ? &w->min_size : &w->max_size) != 0) {
+      *error = "invalid size";
+      return -1;
+    }
+    break;
+  }
+  return 2;
+}
+
+// fts joins a child to its parent's path with a '/', unless that path
+// ends in one already.
+static size_t base_len(const FTSENT *p) {
+  size_t len = p->fts_pathlen;
+  if (len > 0 && p->fts_path[len - 1] == '/')
+    len--;
+  return len;
+}
+
+// Unload the ignore files of directories at 'level' or deeper, which
+// the traversal has left.
+static void pop(struct walk *w, int level) {
+  while (w->num_layers > 0 && w->layers[w->num_layers - 1].level >= level) {
+    struct walk_layer *l = &w->layers[--w->num_layers];
+    free(l->base);
+    free_rules(&l->rules);
+  }
+}
+
+// Load the ignore file of the directory 'p', if it has one.
+static void push(struct walk *w, const FTSENT *p) {
+  size_t len = base_len(p);
+  char *path = malloc(len + strlen(w->ignore_file) + 2);
+  if (path == NULL)
+    return;
+  sprintf(path, "%.*s/%s", (int)len, p->fts_path, w->ignore_file);
+
+  FILE *f = fopen(path, "r");
+  if (f == NULL) {
+    if (errno != ENOENT && errno != ENOTDIR)
+      warn("cannot read %s", path);
+    free(path);
+    return;
+  }
+
+  struct walk_layer l;
+  memset(&l, 0, sizeof(l));
+  l.level = p->fts_level;
+  l.base_len = len;
+
+  char *line = NULL;
+  size_t linelen = 0;
+  ssize_t n;
+  while ((n = getline(&line, &linelen, f)) != -1) {
+    while (n > 0 && (line[n - 1] == '\n' || line[n - 1] == '\r'))
+      n--;
+    // Trailing spaces are dropped, unless escaped with a backslash.
+    while (n > 0 && line[n - 1] == ' ' && !(n > 1 && line[n - 2] == '\\'))
+      n--;
+    line[n] = '\0';
+
+    // '\#' and '\!' stay as they are: match() reads them as literals.
+    if (n == 0 || line[0] == '#')
+      continue;
+    if (add_glob(&l.rules, line, 1) != 0)
+      break;
+  }
+  free(line);
+  fclose(f);
+  free(path);
+
+  if (l.rules.num == 0)
+    return;
+
+  l.base = strndup(p->fts_path, len);
+  if (l.base == NULL) {
+    free_rules(&l.rules);
+    return;
+  }
+  if (w->num_layers == w->cap_layers) {
+    int cap = w->cap_layers ? 2 * w->cap_layers : 8;
+    struct walk_layer *bigger =
+        realloc(w->layers, (size_t)cap * sizeof(struct walk_layer));
+    if (bigger == NULL) {
+      free(l.base);
+      free_rules(&l.rules);
+      return;
+    }
+    w->layers = bigger;
+    w->cap_layers = cap;
+  }
+  w->layers[w->num_layers++] = l;
+}
+
+// Whether --exclude or an ignore file leaves 'p' out.
+static int left_out(const struct walk *w, const FTSENT *p, int is_dir) {
+  const char *rel = p->fts_level == 0 ? p->fts_name
+                                      : p->fts_path + w->root_len + 1;
+
+  if (rules_match(&w->exclude, p->fts_name, rel, is_dir) > 0)
+    return 1;
+
+  // The ignore file nearest to the entry has the last word.
+  for (int i = w->num_layers - 1; i >= 0; i--) {
+    const struct walk_layer *l = &w->layers[i];
+    int rc = rules_match(&l->rules, p->fts_name,
+                         p->fts_path + l->base_len + 1, is_dir);
+    if (rc != 0)
+      return rc > 0;
+  }
+  return 0;
+}
+
+static int size_ok(const struct walk *w, off_t size) {
+  return size >= w->min_size && (w->max_size < 0 || size <= w->max_size);
+}
+
+int walk_visit(struct walk *w, FTS *ftsp, FTSENT *p) {
+  switch (p->fts_info) {
+  case FTS_D:
+    pop(w, p->fts_level);
+    if (p->fts_level == 0) {
+      w->root_len = base_len(p);
+    } else if (left_out(w, p, 1)) {
+      fts_set(ftsp, p, FTS_SKIP);
+      return 0;
+    }
+    if (w->max_depth >= 0 && p->fts_level > w->max_depth) {
+      // More than --max-depth directories below the root.
+      fts_set(ftsp, p, FTS_SKIP);
+      return 0;
+    }
+    if (dedup_inode(&w->seen, p->fts_statp->st_dev, p->fts_statp->st_ino)) {
+      // Reached again through a symbolic link.
+      fts_set(ftsp, p, FTS_SKIP);
+      return 0;
+    }
+    if (w->ignore_file != NULL)
+      push(w, p);
+    return 1;
+
+  case FTS_DP:
+    pop(w, p->fts_level);
+    return 1;
+
+  case FTS_F: {
+    const char *rel = p->fts_level == 0 ? p->fts_name
+                                        : p->fts_path + w->root_len + 1;
+    const struct stat *st = p->fts_statp;
+    if (left_out(w, p, 0) || !size_ok(w, st->st_size))
+      return 0;
+    if (w->include.num > 0 &&
+        rules_match(&w->include, p->fts_name, rel, 0) <= 0)
+      return 0;
+    if (dedup_inode(&w->seen, st->st_dev, st->st_ino))
+      return 0;
+    w->peer = w->dedup_content ? dedup_size(&w->seen, p->fts_path, st->st_size)
+                               : NULL;
+    return 1;
+  }
+
+  default:
+    return 1;
+  }
+}
+
+int walk_duplicate(struct walk *w, const char *path, off_t size,
+                   const char *peer) {
+  return peer != NULL && dedup_content(&w->seen, path, size, peer);
+}
+
+int walk_wanted(const struct walk *w, const char *path, const char *rel,
+                const struct stat *st) {
+  const char *name = strrchr(path, '/');
+  name = name != NULL ? name + 1 : path;
+
+  if (S_ISDIR(st->st_mode)) {
+    // Its fts_level would be one more than the '/'s in 'rel'.
+    int level = 1;
+    for (const char *s = rel; *s != '\0'; s++)
+      level += *s == '/';
+    return rules_match(&w->exclude, name, rel, 1) <= 0 &&
+           (w->max_depth < 0 || level <= w->max_depth);
+  }
+
+  if (rules_match(&w->exclude, name, rel, 0) > 0 ||
+      !size_ok(w, st->st_size))
+    return 0;
+  return w->include.num == 0 || rules_match(&w->include, name, rel, 0) > 0;
+}
+
+void walk_free(struct walk *w) {
+  pop(w, 0);
+  free(w->layers);
+  free_rules(&w->include);
+  free_rules(&w->exclude);
+  free(w->ignore_file);
+  dedup_free(&w->seen);
+  walk_init(w);
+}
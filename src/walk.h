@@ -0,0 +1,123 @@
+#ifndef WALK_H
+#define WALK_H
+
+#include <fts.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "dedup.h"
+
+// Which files a traversal looks at, shared by all the tools:
+//
+//   --include GLOB     Only files whose name matches (any of) these.
+//   --exclude GLOB     Neither files nor directories matching these.
+//   --ignore-file NAME Read .gitignore-style rules from a file of this
+//                      name in every directory, for its subtree.
+//   --max-depth N      Go at most N directories below the roots.
+//   --min-size SIZE    Only files of at least (or, with --max-size, at
+//   --max-size SIZE    most) SIZE bytes; SIZE may end in k, M or G.
+//   --dedup-content    Scan only one of several files with the same
+//                      contents (see dedup.h).
+//
+// A glob without a '/' matches the name of a file or directory; one
+// with a '/' matches its path from the root (for --include and
+// --exclude) or from the directory of the ignore file.  '*' and '?'
+// do not match '/', while '**' does.  In ignore files, a trailing '/'
+// makes a rule match directories only, and a leading '!' brings back
+// what an earlier rule left out.
+//
+// Directories left out are pruned with fts_set(FTS_SKIP) when they
+// are first met, so nothing below them is read, or even stat()ed.
+// Directories named as roots are always entered.
+//
+// Whatever the options, every file and directory is visited once,
+// however many links lead to it.
+
+#define WALK_USAGE                                                       \
+  "[--include GLOB] [--exclude GLOB] [--ignore-file NAME] "              \
+  "[--max-depth N] [--min-size SIZE] [--max-size SIZE] [--dedup-content]"
+
+// A compiled glob.
+struct walk_glob {
+  char *pattern;
+  size_t len;
+  int kind;     // How it is matched; see walk.c.
+  int anchored; // It contains a '/', and is matched against paths.
+  int dir_only; // Ignore files: it ended in '/'.
+  int negate;   // Ignore files: it started with '!'.
+};
+
+struct walk_rules {
+  struct walk_glob *globs;
+  int num;
+  int cap;
+};
+
+// The rules of an ignore file, in force below 'base'.
+struct walk_layer {
+  int level; // The fts_level of 'base'.
+  char *base;
+  size_t base_len;
+  struct walk_rules rules;
+};
+
+struct walk {
+  struct walk_rules include;
+  struct walk_rules exclude;
+  char *ignore_file; // NULL: none.
+  int max_depth;     // -1: no limit.
+  off_t min_size;
+  off_t max_size;    // -1: no limit.
+  int dedup_content;
+
+  // What has been visited, and for --dedup-content, the sizes and
+  // contents of the files.
+  struct dedup seen;
+
+  // --dedup-content: set by walk_visit() for every file it lets
+  // through.  If not NULL, the file may be a copy of another, and
+  // walk_duplicate() is to be asked before scanning it.
+  const char *peer;
+
+  // State of the traversal: the ignore files of the directories we
+  // are in, innermost last, and the root we are under.
+  struct walk_layer *layers;
+  int num_layers;
+  int cap_layers;
+  size_t root_len;
+};
+
+void walk_init(struct walk *w);
+
+// If 'argv[i]' is one of the options above, take it and its argument.
+// Returns the number of arguments taken, 0 if the option is not ours,
+// or -1 on error, in which case '*error' says why.  Safe to call from
+// several threads at once, on different 'w'.
+int walk_parse(struct walk *w, int argc, char *const *argv, int i,
+               const char **error);
+
+// Look at an entry returned by fts_read(), which must have been opened
+// without FTS_NOSTAT.  Returns non-zero if the caller is to go on with
+// it (for FTS_F, scan it; for FTS_D, watch it, say).  Directories that
+// are left out are pruned.  Every entry must be passed in, or the
+// ignore files of the directories left behind are not unloaded.
+int walk_visit(struct walk *w, FTS *ftsp, FTSENT *p);
+
+// Whether the file at 'path', of 'size' bytes, for which walk_visit()
+// set 'peer', has the same contents as a file scanned already.  Reads
+// the file, so this is best called from the thread that would scan
+// it.  Safe to call from several threads at once.
+int walk_duplicate(struct walk *w, const char *path, off_t size,
+                   const char *peer);
+
+// Whether 'path', found outside of a traversal (under --follow), is
+// to be scanned if a regular file, or walked if a directory.  'rel' is
+// its path below the root it was found under, which globs with a '/'
+// are matched against, as walk_visit() does.  --exclude, --include,
+// --max-depth and the size limits are applied, but not ignore files.
+int walk_wanted(const struct walk *w, const char *path, const char *rel,
+                const struct stat *st);
+
+void walk_free(struct walk *w);
+
+#endif